@@ -0,0 +1,258 @@
+/* Request aggregation
+ *
+ * A brute force run repeats the same few (source, community) pairs
+ * millions of times, so instead of a line per request each pair is only
+ * logged when first seen and then summed up in a summary line once per
+ * summary interval, if it was used again since.
+ *
+ * Every thread that handles requests has a table of its own, with room
+ * for a fixed number of pairs.  It is set associative: a pair hashes to a
+ * set of AGGREGATE_WAYS slots, whose tags share one cache line, and when
+ * its set is full the pair seen least recently is summed up and evicted.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "snmpbug.h"
+
+#define AGGREGATE_WAYS		8	/* Slots per set, their tags fill a cache line */
+
+#define AGGREGATE_GET		0
+#define AGGREGATE_GETNEXT	1
+#define AGGREGATE_GETBULK	2
+#define AGGREGATE_SET		3
+#define AGGREGATE_OTHER		4
+#define AGGREGATE_NR_TYPES	5
+
+typedef struct aggregate_s {
+	my_in_addr_t        addr;
+	char                community[MAX_STRING_SIZE];
+	time_t              first_seen;
+	time_t              last_seen;
+	unsigned long       count;
+	unsigned long       new_count;		/* Since the last line about it */
+	unsigned long       type_count[AGGREGATE_NR_TYPES];
+	unsigned long long  bytes;
+} aggregate_t;
+
+typedef struct aggregate_table_s {
+	uint64_t           *tag_list;		/* 0 for a free slot */
+	aggregate_t        *entry_list;
+	size_t              set_mask;
+	time_t              next_summary;
+} aggregate_table_t;
+
+static __thread aggregate_table_t *aggregate_table;
+static __thread int     aggregate_failed;
+
+/* Allocate the table of this thread on first use */
+static aggregate_table_t *aggregate_get_table(void)
+{
+	aggregate_table_t *table;
+	size_t nr_sets = 1;
+
+	if (aggregate_table || aggregate_failed)
+		return aggregate_table;
+
+	while (nr_sets * AGGREGATE_WAYS < g_aggregate_size)
+		nr_sets *= 2;
+
+	table = calloc(1, sizeof(*table));
+	if (table) {
+		if (posix_memalign((void **)&table->tag_list, 64, nr_sets * AGGREGATE_WAYS * sizeof(uint64_t)))
+			table->tag_list = NULL;
+		table->entry_list = calloc(nr_sets * AGGREGATE_WAYS, sizeof(aggregate_t));
+	}
+	if (!table || !table->tag_list || !table->entry_list) {
+		logit(LOG_WARNING, ENOMEM, "could not allocate %zu aggregates, logging every request",
+		      g_aggregate_size);
+		if (table) {
+			free(table->tag_list);
+			free(table->entry_list);
+			free(table);
+		}
+		aggregate_failed = 1;
+		return NULL;
+	}
+
+	memset(table->tag_list, 0, nr_sets * AGGREGATE_WAYS * sizeof(uint64_t));
+	table->set_mask = nr_sets - 1;
+	aggregate_table = table;
+
+	return table;
+}
+
+static uint64_t aggregate_hash(const my_in_addr_t *addr, const char *community, size_t len)
+{
+	const uint64_t k = 0x9E3779B97F4A7C15ULL;
+	uint64_t h, w[2];
+	size_t i;
+
+	memcpy(w, addr, sizeof(w));
+	h = (w[0] * k) ^ w[1] ^ len;
+	for (i = 0; i < len; i += sizeof(w[0])) {
+		w[0] = 0;
+		memcpy(&w[0], &community[i], len - i < sizeof(w[0]) ? len - i : sizeof(w[0]));
+		h = (h ^ w[0]) * k;
+		h ^= h >> 29;
+	}
+	h *= k;
+
+	return (h ^ (h >> 32)) | 1;
+}
+
+static void format_time(char *buf, size_t size, time_t t)
+{
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	strftime(buf, size, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+/* Sum up what an entry saw since its last line */
+static void aggregate_log(aggregate_t *entry)
+{
+	char straddr[my_inet_addrstrlen];
+	char first[32], last[32];
+
+	if (IN6_IS_ADDR_V4MAPPED(&entry->addr))
+		inet_ntop(AF_INET, &entry->addr.s6_addr[12], straddr, sizeof(straddr));
+	else
+		inet_ntop(AF_INET6, &entry->addr, straddr, sizeof(straddr));
+	format_time(first, sizeof(first), entry->first_seen);
+	format_time(last, sizeof(last), entry->last_seen);
+
+	logit(LOG_INFO, 0, "host %s used community: '%s' %lu more times "
+	      "(%lu get, %lu getnext, %lu getbulk, %lu set, %lu other, %llu bytes), "
+	      "%lu times from %s to %s", straddr, entry->community, entry->new_count,
+	      entry->type_count[AGGREGATE_GET], entry->type_count[AGGREGATE_GETNEXT],
+	      entry->type_count[AGGREGATE_GETBULK], entry->type_count[AGGREGATE_SET],
+	      entry->type_count[AGGREGATE_OTHER], entry->bytes, entry->count, first, last);
+
+	entry->new_count = 0;
+	entry->bytes = 0;
+	memset(entry->type_count, 0, sizeof(entry->type_count));
+}
+
+/*
+ * Log the summaries that are due, or all of them that are pending, e.g.
+ * before exiting.  Only sums up the table of the calling thread.
+ */
+void aggregate_flush(time_t now, int all)
+{
+	aggregate_table_t *table = aggregate_table;
+	size_t i;
+
+	if (!table || (!all && now < table->next_summary))
+		return;
+
+	for (i = 0; i < (table->set_mask + 1) * AGGREGATE_WAYS; i++) {
+		if (table->tag_list[i] && table->entry_list[i].new_count)
+			aggregate_log(&table->entry_list[i]);
+	}
+	table->next_summary = now + g_summary_interval;
+}
+
+/* Count a request, returns 1 when it has to be logged as never seen before */
+int aggregate_request(const request_t *request, const client_t *client)
+{
+	aggregate_table_t *table;
+	aggregate_t *entry;
+	uint64_t tag, *tags;
+	size_t set, len, i, victim = 0;
+	int type;
+
+	if (!g_aggregate_size || !(table = aggregate_get_table()))
+		return 1;
+
+	if (client->timestamp >= table->next_summary) {
+		if (table->next_summary)
+			aggregate_flush(client->timestamp, 0);
+		else
+			table->next_summary = client->timestamp + g_summary_interval;
+	}
+
+	len = strlen(request->community);
+	tag = aggregate_hash(&client->addr, request->community, len);
+	set = ((tag >> 32) & table->set_mask) * AGGREGATE_WAYS;
+	tags = &table->tag_list[set];
+
+	for (i = 0; i < AGGREGATE_WAYS; i++) {
+		if (tags[i] != tag)
+			continue;
+
+		entry = &table->entry_list[set + i];
+		if (memcmp(&entry->addr, &client->addr, sizeof(entry->addr)) ||
+		    memcmp(entry->community, request->community, len + 1))
+			continue;
+		break;
+	}
+
+	if (i == AGGREGATE_WAYS) {
+		/* Never seen, take a free slot or the one seen least recently */
+		for (i = 0; i < AGGREGATE_WAYS; i++) {
+			if (!tags[i])
+				break;
+			if (table->entry_list[set + i].last_seen < table->entry_list[set + victim].last_seen)
+				victim = i;
+		}
+		if (i == AGGREGATE_WAYS) {
+			i = victim;
+			if (table->entry_list[set + i].new_count)
+				aggregate_log(&table->entry_list[set + i]);
+		}
+
+		entry = &table->entry_list[set + i];
+		memset(entry, 0, sizeof(*entry));
+		entry->addr = client->addr;
+		memcpy(entry->community, request->community, len + 1);
+		entry->first_seen = client->timestamp;
+		entry->last_seen = client->timestamp;
+		entry->count = 1;
+		tags[i] = tag;
+
+		return 1;
+	}
+
+	switch (request->type) {
+	case BER_TYPE_SNMP_GET:
+		type = AGGREGATE_GET;
+		break;
+	case BER_TYPE_SNMP_GETNEXT:
+		type = AGGREGATE_GETNEXT;
+		break;
+	case BER_TYPE_SNMP_GETBULK:
+		type = AGGREGATE_GETBULK;
+		break;
+	case BER_TYPE_SNMP_SET:
+		type = AGGREGATE_SET;
+		break;
+	default:
+		type = AGGREGATE_OTHER;
+		break;
+	}
+
+	entry->last_seen = client->timestamp;
+	entry->count++;
+	entry->new_count++;
+	entry->type_count[type]++;
+	entry->bytes += client->size;
+
+	return 0;
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -0,0 +1,855 @@
+/* Codec microbenchmarks, run with 'make bench'
+ *
+ * Times the protocol.c entry points over a set of typical and atypical
+ * requests and prints one JSON document with ns, cycles and allocations
+ * per operation, so runs can be compared when the codec changes.  The
+ * codec is included rather than linked to reach its static functions,
+ * allocations are counted by linking with --wrap=malloc and friends.
+ * The request path must not allocate once warmed up, the run exits with
+ * an error if it does.  Checks of the codec against a random corpus run
+ * first, alone with 'make check'.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "protocol.c"
+
+#define BENCH_ROUNDS		7	/* Best of, against noise */
+#define BENCH_MIN_NS		20000000
+
+typedef struct packet_s {
+	const char          *name;
+	unsigned char        data[MAX_PACKET_SIZE];
+	size_t               size;
+} packet_t;
+
+typedef struct result_s {
+	double               ns;
+	double               cycles;
+	double               allocs;
+} result_t;
+
+static unsigned long     m_allocs;
+static packet_t          m_packet_list[16];
+static size_t            m_packet_list_length;
+static FILE             *m_json;
+static int               m_first = 1;
+static int               m_failed;
+static uint32_t          m_nr_sources;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&m_allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&m_allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&m_allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Packet builders, BER written forwards with room for the headers
+ */
+
+/* Length of the whole BER element at buf */
+static size_t ber_len(const unsigned char *buf)
+{
+	if (!(buf[1] & 0x80))
+		return 2 + buf[1];
+	if ((buf[1] & 0x7F) == 1)
+		return 3 + buf[2];
+
+	return 4 + ((buf[2] << 8) | buf[3]);
+}
+
+static size_t put_hdr(unsigned char *buf, int type, size_t len)
+{
+	encode_snmp_sequence_header(buf, len, type);
+	return get_hdrlen(len);
+}
+
+static size_t put_oid(unsigned char *buf, const unsigned int *subid_list, size_t length)
+{
+	memcpy(m_oid.subid_list, subid_list, length * sizeof(subid_list[0]));
+	m_oid.subid_list_length = length;
+	encode_snmp_oid(buf, &m_oid);
+
+	return ber_len(buf);
+}
+
+static void add_packet(const char *name, int version, int type, size_t nr_varbinds,
+		       const unsigned char *value, size_t value_len, int error_status, int error_index)
+{
+	static const unsigned int base[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10 };
+	unsigned char varbinds[MAX_PACKET_SIZE], pdu[MAX_PACKET_SIZE], msg[MAX_PACKET_SIZE];
+	unsigned int subid_list[NELEMS(base) + 1];
+	packet_t *packet = &m_packet_list[m_packet_list_length++];
+	size_t i, len, vbl = 0, pos;
+
+	memcpy(subid_list, base, sizeof(base));
+	for (i = 0; i < nr_varbinds; i++) {
+		unsigned char vb[256];
+
+		subid_list[NELEMS(base)] = 1 + i * 37;
+		len = put_oid(vb, subid_list, NELEMS(subid_list));
+		memcpy(&vb[len], value, value_len);
+		len += value_len;
+		vbl += put_hdr(&varbinds[vbl], BER_TYPE_SEQUENCE, len);
+		memcpy(&varbinds[vbl], vb, len);
+		vbl += len;
+	}
+
+	pos = 0;
+	encode_snmp_integer(&pdu[pos], 0x2A3B4C5D);
+	pos += get_intlen(0x2A3B4C5D);
+	encode_snmp_integer(&pdu[pos], error_status);
+	pos += get_intlen(error_status);
+	encode_snmp_integer(&pdu[pos], error_index);
+	pos += get_intlen(error_index);
+	pos += put_hdr(&pdu[pos], BER_TYPE_SEQUENCE, vbl);
+	memcpy(&pdu[pos], varbinds, vbl);
+	pos += vbl;
+
+	len = 0;
+	encode_snmp_integer(&msg[len], version);
+	len += get_intlen(version);
+	encode_snmp_string(&msg[len], "public");
+	len += get_strlen("public");
+	len += put_hdr(&msg[len], type, pos);
+	memcpy(&msg[len], pdu, pos);
+	len += pos;
+
+	packet->name = name;
+	packet->size = put_hdr(packet->data, BER_TYPE_SEQUENCE, len);
+	memcpy(&packet->data[packet->size], msg, len);
+	packet->size += len;
+}
+
+static void add_packets(void)
+{
+	static const unsigned char null[] = { BER_TYPE_NULL, 0x00 };
+	static const unsigned char integer[] = { BER_TYPE_INTEGER, 0x02, 0x01, 0x00 };
+	packet_t *packet;
+
+	add_packet("get", SNMP_VERSION_2C, BER_TYPE_SNMP_GET, 1, null, sizeof(null), 0, 0);
+	add_packet("get_v1", SNMP_VERSION_1, BER_TYPE_SNMP_GET, 1, null, sizeof(null), 0, 0);
+	add_packet("getnext", SNMP_VERSION_2C, BER_TYPE_SNMP_GETNEXT, 4, null, sizeof(null), 0, 0);
+	add_packet("getbulk", SNMP_VERSION_2C, BER_TYPE_SNMP_GETBULK, 4, null, sizeof(null), 1, 10);
+	add_packet("set", SNMP_VERSION_2C, BER_TYPE_SNMP_SET, 2, integer, sizeof(integer), 0, 0);
+	add_packet("oversized", SNMP_VERSION_2C, BER_TYPE_SNMP_GETNEXT, 100, null, sizeof(null), 0, 0);
+
+	/* Truncated in the last varbind, and with an unsupported tag */
+	add_packet("truncated", SNMP_VERSION_2C, BER_TYPE_SNMP_GET, 4, null, sizeof(null), 0, 0);
+	m_packet_list[m_packet_list_length - 1].size -= 3;
+	add_packet("bad_tag", SNMP_VERSION_2C, BER_TYPE_SNMP_GET, 4, null, sizeof(null), 0, 0);
+	packet = &m_packet_list[m_packet_list_length - 1];
+	packet->data[packet->size - 2] = 0x1F;
+}
+
+/*
+ * Operations, each does one unit of work on the packet
+ */
+
+typedef int (*op_t)(const packet_t *packet, client_t *client);
+
+static request_t  m_request_copy;
+static response_t m_response_copy;
+
+static int op_decode(const packet_t *packet, client_t *client)
+{
+	request_t request;
+
+	client->size = packet->size;
+	return decode_snmp_request(&request, client);
+}
+
+static int op_complete(const packet_t *packet, client_t *client)
+{
+	client->size = packet->size;
+	return snmp_packet_complete(client);
+}
+
+/* Run the request through the handlers once, so the encoders have input */
+static int prepare_response(const packet_t *packet, client_t *client)
+{
+	memcpy(client->packet, packet->data, packet->size);
+	client->size = packet->size;
+	if (decode_snmp_request(&m_request_copy, client) == -1)
+		return -1;
+
+	m_response_copy.error_status = SNMP_STATUS_OK;
+	m_response_copy.error_index = 0;
+	m_response_copy.value_list = m_value_list;
+	m_response_copy.value_list_size = m_request_copy.varbind_list_length;
+	m_response_copy.value_list_length = 0;
+
+	switch (m_request_copy.type) {
+	case BER_TYPE_SNMP_GET:
+		return handle_snmp_get(&m_request_copy, &m_response_copy, client);
+	case BER_TYPE_SNMP_GETNEXT:
+		return handle_snmp_getnext(&m_request_copy, &m_response_copy, client);
+	case BER_TYPE_SNMP_SET:
+		return handle_snmp_set(&m_request_copy, &m_response_copy, client);
+	case BER_TYPE_SNMP_GETBULK:
+		return handle_snmp_getbulk(&m_request_copy, &m_response_copy, client);
+	}
+
+	return -1;
+}
+
+static int op_encode(const packet_t *packet, client_t *client)
+{
+	memcpy(client->packet, packet->data, packet->size);
+	client->size = packet->size;
+	return encode_snmp_response(&m_request_copy, &m_response_copy, client);
+}
+
+static int op_rewrite(const packet_t *packet, client_t *client)
+{
+	memcpy(client->packet, packet->data, packet->size);
+	client->size = packet->size;
+	return rewrite_snmp_response(&m_request_copy, &m_response_copy, client);
+}
+
+static int op_encode_oid(const packet_t UNUSED(*packet), client_t *client)
+{
+	return encode_snmp_oid(client->packet, &m_oid);
+}
+
+static int op_snmp(const packet_t *packet, client_t *client)
+{
+	memcpy(client->packet, packet->data, packet->size);
+	client->size = packet->size;
+	return snmp(client);
+}
+
+/* A rate limiter lookup for one of m_nr_sources sources, in turn */
+static int op_ratelimit(const packet_t UNUSED(*packet), client_t UNUSED(*client))
+{
+	static my_in_addr_t addr = { .s6_addr = { [10] = 0xFF, [11] = 0xFF, [12] = 198, [13] = 18 } };
+	static uint32_t n;
+
+	n = (n + 1) % m_nr_sources;
+	memcpy(&addr.s6_addr[14], &n, 2);
+	addr.s6_addr[12] = 198 ^ (n >> 16);
+
+	return ratelimit(&addr, 0);
+}
+
+static int op_logit(const packet_t UNUSED(*packet), client_t UNUSED(*client))
+{
+	return logit(LOG_INFO, 0, "host %s used community: '%s'", "192.0.2.1", "public");
+}
+
+/*
+ * Harness
+ */
+
+static void report(const char *op, const char *packet, const result_t *result)
+{
+	fprintf(m_json, "%s\n    { \"op\": \"%s\", \"packet\": \"%s\", \"ns_per_op\": %.1f, ",
+		m_first ? "" : ",", op, packet, result->ns);
+#ifdef HAVE_RDTSC
+	fprintf(m_json, "\"cycles_per_op\": %.1f, ", result->cycles);
+#else
+	fprintf(m_json, "\"cycles_per_op\": null, ");
+#endif
+	fprintf(m_json, "\"allocs_per_op\": %.3f }", result->allocs);
+	m_first = 0;
+}
+
+/* Best of BENCH_ROUNDS, each running long enough to be measured reliably, its allocations per op */
+static double run(const char *name, op_t op, const packet_t *packet, size_t batch)
+{
+	static client_t client;
+	result_t best = { 0, 0, 0 };
+	uint64_t ns, cycles, start_ns, start_cycles;
+	unsigned long allocs, n, i;
+	int round;
+
+	memcpy(client.packet, packet->data, packet->size);
+	client.size = packet->size;
+	client.timestamp_nsec = -1;
+
+	/* Untimed, so lazily allocated tables are not counted against the op */
+	op(packet, &client);
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		n = 0;
+		ns = cycles = 0;
+		allocs = m_allocs;
+		do {
+			start_ns = now_ns();
+			start_cycles = now_cycles();
+			for (i = 0; i < batch; i++)
+				op(packet, &client);
+			cycles += now_cycles() - start_cycles;
+			ns += now_ns() - start_ns;
+			n += batch;
+
+			/* Give the log writer a chance to empty its ring, untimed */
+			if (op == op_logit)
+				usleep(2000);
+		} while (ns < BENCH_MIN_NS);
+
+		if (round == 0 || (double)ns / n < best.ns) {
+			best.ns = (double)ns / n;
+			best.cycles = (double)cycles / n;
+			best.allocs = (double)(m_allocs - allocs) / n;
+		}
+	}
+
+	report(name, packet->name, &best);
+
+	return best.allocs;
+}
+
+/* Same for an op of the request path, which fails the run if it allocates */
+static void run_hot(const char *name, op_t op, const packet_t *packet, size_t batch)
+{
+	if (run(name, op, packet, batch) > 0) {
+		fprintf(stderr, "%s allocates memory on %s packets\n", name, packet->name);
+		m_failed = 1;
+	}
+}
+
+/*
+ * Checks, run before the benchmarks and alone with 'make check'.  They
+ * use a corpus of random requests, some of them mangled, generated from
+ * a fixed seed, so every run checks the same packets.
+ */
+
+#define CHECK_NR_PACKETS	100000
+#define CHECK_NR_REPORTS	10	/* Failures shown per run */
+#define CHECK_GUARD_SIZE	(128 << 10)	/* More than a 16 bit length reaches */
+
+static uint64_t          m_random = 0x9E3779B97F4A7C15ULL;
+static char              m_check_dump[MAX_PACKET_SIZE * 3];
+static unsigned          m_check_reports;
+
+static uint32_t random32(void)
+{
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 7;
+	m_random ^= m_random << 17;
+
+	return m_random >> 32;
+}
+
+static uint32_t random_below(uint32_t n)
+{
+	return random32() % n;
+}
+
+static void check_failed(const char *check, const char *why, const packet_t *packet)
+{
+	m_failed = 1;
+	if (m_check_reports++ >= CHECK_NR_REPORTS)
+		return;
+
+	hexdump(m_check_dump, sizeof(m_check_dump), packet->data, packet->size);
+	fprintf(stderr, "%s: %s, %s packet %s\n", check, why, packet->name, m_check_dump);
+}
+
+/* A header of minimal length, now and then a longer form, which is legal BER too */
+static size_t put_any_hdr(unsigned char *buf, int type, size_t len)
+{
+	if (len > 0xFFFF || random_below(32))
+		return put_hdr(buf, type, len);
+
+	buf[0] = type;
+	if (len < 0x100 && random_below(2)) {
+		buf[1] = 0x81;
+		buf[2] = len;
+		return 3;
+	}
+	buf[1] = 0x82;
+	buf[2] = len >> 8;
+	buf[3] = len & 0xFF;
+
+	return 4;
+}
+
+/* An integer, now and then with a redundant leading byte */
+static size_t put_any_int(unsigned char *buf, int value)
+{
+	size_t len = get_intlen(value);
+
+	encode_snmp_integer(buf, value);
+	if (len > 5 || random_below(32))
+		return len;
+
+	memmove(&buf[3], &buf[2], len - 2);
+	buf[2] = value < 0 ? 0xFF : 0x00;
+	buf[1]++;
+
+	return len + 1;
+}
+
+/* Subids mostly small, some wide, now and then with a redundant 0x80 byte */
+static size_t put_any_oid(unsigned char *buf)
+{
+	unsigned char oid[128], digit[5];
+	size_t i, j, hdr, len = 0, nr_subids = 1 + random_below(16);
+	uint32_t subid;
+
+	oid[len++] = random_below(16) ? 0x2B : random_below(0x80);
+	for (i = 0; i < nr_subids; i++) {
+		switch (random_below(10)) {
+		case 0:
+			subid = random32();
+			break;
+		case 1:
+		case 2:
+			subid = random_below(0x4000);
+			break;
+		default:
+			subid = random_below(0x80);
+			break;
+		}
+
+		for (j = 0; j == 0 || subid; j++, subid >>= 7)
+			digit[j] = subid & 0x7F;
+		if (!random_below(32))
+			oid[len++] = 0x80;
+		while (j--)
+			oid[len++] = digit[j] | (j ? 0x80 : 0);
+	}
+
+	hdr = put_any_hdr(buf, BER_TYPE_OID, len);
+	memcpy(&buf[hdr], oid, len);
+
+	return hdr + len;
+}
+
+static size_t put_any_value(unsigned char *buf, int type)
+{
+	static const unsigned char null[] = { BER_TYPE_NULL, 0x00 };
+	static const unsigned char ticks[] = { BER_TYPE_TIME_TICKS, 0x02, 0x01, 0x00 };
+	char str[32];
+	size_t i, len;
+
+	if (type != BER_TYPE_SNMP_SET && random_below(16)) {
+		memcpy(buf, null, sizeof(null));
+		return sizeof(null);
+	}
+
+	switch (random_below(4)) {
+	case 0:
+		return put_any_int(buf, random32());
+	case 1:
+		len = random_below(sizeof(str));
+		for (i = 0; i < len; i++)
+			str[i] = 'a' + random_below(26);
+		i = put_any_hdr(buf, BER_TYPE_OCTET_STRING, len);
+		memcpy(&buf[i], str, len);
+		return i + len;
+	case 2:
+		return put_any_oid(buf);
+	}
+	memcpy(buf, ticks, sizeof(ticks));
+
+	return sizeof(ticks);
+}
+
+/* A v1 or v2c request of any type with random fields and varbinds */
+static void random_packet(packet_t *packet)
+{
+	static const int types[] = {
+		BER_TYPE_SNMP_GET, BER_TYPE_SNMP_GETNEXT, BER_TYPE_SNMP_GETBULK, BER_TYPE_SNMP_SET,
+		BER_TYPE_SNMP_GET, BER_TYPE_SNMP_GETNEXT, BER_TYPE_SNMP_GETBULK, BER_TYPE_SNMP_TRAP
+	};
+	unsigned char varbinds[MAX_PACKET_SIZE], pdu[MAX_PACKET_SIZE], msg[MAX_PACKET_SIZE];
+	unsigned char vb[512];
+	char community[40];
+	size_t i, len, vbl = 0, pos, nr_varbinds;
+	int type = types[random_below(NELEMS(types))];
+
+	nr_varbinds = random_below(8) ? random_below(8) : random_below(64);
+	for (i = 0; i < nr_varbinds && vbl < MAX_PACKET_SIZE - 512 - 128; i++) {
+		len = put_any_oid(vb);
+		len += put_any_value(&vb[len], type);
+		vbl += put_any_hdr(&varbinds[vbl], BER_TYPE_SEQUENCE, len);
+		memcpy(&varbinds[vbl], vb, len);
+		vbl += len;
+	}
+
+	pos = put_any_int(pdu, random_below(4) ? (int)random_below(0x10000) : (int)random32());
+	if (type == BER_TYPE_SNMP_GETBULK) {
+		pos += put_any_int(&pdu[pos], random_below(4));
+		pos += put_any_int(&pdu[pos], random_below(64));
+	} else {
+		pos += put_any_int(&pdu[pos], random_below(16) ? 0 : (int)random32());
+		pos += put_any_int(&pdu[pos], 0);
+	}
+	pos += put_any_hdr(&pdu[pos], BER_TYPE_SEQUENCE, vbl);
+	memcpy(&pdu[pos], varbinds, vbl);
+	pos += vbl;
+
+	len = random_below(sizeof(community));
+	for (i = 0; i < len; i++)
+		community[i] = random_below(64) ? 'a' + random_below(26) : 0;
+	i = put_any_int(msg, random_below(32) ? (int)random_below(2) : SNMP_VERSION_3);
+	i += put_any_hdr(&msg[i], BER_TYPE_OCTET_STRING, len);
+	memcpy(&msg[i], community, len);
+	i += len;
+	i += put_any_hdr(&msg[i], type, pos);
+	memcpy(&msg[i], pdu, pos);
+	i += pos;
+
+	packet->name = "random";
+	packet->size = put_any_hdr(packet->data, BER_TYPE_SEQUENCE, i);
+	memcpy(&packet->data[packet->size], msg, i);
+	packet->size += i;
+}
+
+/* Overwrite, truncate or extend a request a little, mostly into a malformed one */
+static void mutate(packet_t *packet)
+{
+	static const unsigned char special[] = { 0x00, 0x01, 0x7F, 0x80, 0x81, 0x82, 0x83, 0xFF };
+	size_t n = 1 + random_below(3);
+
+	packet->name = "mangled";
+	while (n--) {
+		switch (random_below(4)) {
+		case 0:
+			if (packet->size)
+				packet->data[random_below(packet->size)] = random_below(0x100);
+			break;
+
+		case 1:
+			if (packet->size)
+				packet->data[random_below(packet->size)] = special[random_below(sizeof(special))];
+			break;
+
+		case 2:
+			packet->size = random_below(packet->size + 1);
+			break;
+
+		case 3:
+			if (packet->size < MAX_PACKET_SIZE)
+				packet->data[packet->size++] = random_below(0x100);
+			break;
+		}
+	}
+}
+
+/*
+ * Whenever the in-place rewrite takes the fast path, its response must be
+ * byte-identical to what the full encoder makes of the same request.
+ */
+static void check_rewrite(void)
+{
+	static client_t rewritten, encoded;
+	response_t response;
+	packet_t packet;
+	unsigned long i, fast = 0;
+	int rc;
+
+	for (i = 0; i < m_packet_list_length + CHECK_NR_PACKETS; i++) {
+		if (i < m_packet_list_length) {
+			packet = m_packet_list[i];
+		} else {
+			random_packet(&packet);
+			if (i & 1)
+				mutate(&packet);
+		}
+
+		if (prepare_response(&packet, &rewritten) == -1)
+			continue;
+		encoded = rewritten;
+		response = m_response_copy;
+
+		rc = rewrite_snmp_response(&m_request_copy, &m_response_copy, &rewritten);
+		if (rc == 1) {
+			if (i == 0)
+				check_failed("rewrite", "no fast path", &packet);
+			continue;
+		}
+		fast++;
+
+		if (rc == -1 || encode_snmp_response(&m_request_copy, &response, &encoded) == -1)
+			check_failed("rewrite", "failed", &packet);
+		else if (rewritten.size != encoded.size || memcmp(rewritten.packet, encoded.packet, encoded.size))
+			check_failed("rewrite", "differs from encoder", &packet);
+	}
+
+	if (fast < CHECK_NR_PACKETS / 10) {
+		fprintf(stderr, "rewrite: fast path taken for only %lu packets\n", fast);
+		m_failed = 1;
+	}
+}
+
+/*
+ * Requests with an element length running past their end, which must be
+ * rejected without reading beyond it.  The client is placed right before
+ * an inaccessible region, so reading far past the end crashes the check.
+ */
+static const packet_t m_overlong_list[] = {
+	{ "oid_length_ffff", {
+		0x30, 0x1E, 0x02, 0x01, 0x01, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+		0xA0, 0x11, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+		0x30, 0x06, 0x30, 0x04, 0x06, 0x82, 0xFF, 0xFF }, 32 },
+	{ "oid_length_100", {
+		0x30, 0x1E, 0x02, 0x01, 0x01, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+		0xA0, 0x11, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+		0x30, 0x06, 0x30, 0x04, 0x06, 0x82, 0x01, 0x00 }, 32 },
+	{ "value_length_ffff", {
+		0x30, 0x23, 0x02, 0x01, 0x01, 0x04, 0x06, 'p', 'u', 'b', 'l', 'i', 'c',
+		0xA0, 0x16, 0x02, 0x01, 0x01, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+		0x30, 0x0B, 0x30, 0x09, 0x06, 0x03, 0x2B, 0x06, 0x01, 0x04, 0x82, 0xFF, 0xFF }, 37 },
+	{ "community_length_3c", {
+		0x30, 0x05, 0x02, 0x01, 0x01, 0x04, 0x3C }, 7 },
+};
+
+static void check_bounds(void)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (sizeof(client_t) + page - 1) / page * page;
+	request_t request;
+	client_t *client;
+	unsigned char *map;
+	size_t i;
+
+	map = mmap(NULL, size + CHECK_GUARD_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED || mprotect(&map[size], CHECK_GUARD_SIZE, PROT_NONE)) {
+		perror("bounds: cannot map the client");
+		m_failed = 1;
+		return;
+	}
+	client = (client_t *)&map[size - sizeof(client_t)];
+
+	for (i = 0; i < NELEMS(m_overlong_list); i++) {
+		const packet_t *packet = &m_overlong_list[i];
+
+		memcpy(client->packet, packet->data, packet->size);
+		client->size = packet->size;
+		if (decode_snmp_request(&request, client) != -1)
+			check_failed("bounds", "accepted", packet);
+	}
+
+	munmap(map, size + CHECK_GUARD_SIZE);
+}
+
+/* decode_len() as it was before the tag table, the reference for check_decode_len() */
+static int ref_decode_len(const unsigned char *packet, size_t size, size_t *pos, int *type, size_t *len)
+{
+	size_t length_of_len;
+
+	if (*pos >= size)
+		return -1;
+
+	switch (packet[*pos]) {
+	case BER_TYPE_BOOLEAN:
+	case BER_TYPE_INTEGER:
+	case BER_TYPE_BIT_STRING:
+	case BER_TYPE_OCTET_STRING:
+	case BER_TYPE_NULL:
+	case BER_TYPE_OID:
+	case BER_TYPE_SEQUENCE:
+	case BER_TYPE_COUNTER:
+	case BER_TYPE_GAUGE:
+	case BER_TYPE_TIME_TICKS:
+	case BER_TYPE_NO_SUCH_OBJECT:
+	case BER_TYPE_NO_SUCH_INSTANCE:
+	case BER_TYPE_END_OF_MIB_VIEW:
+	case BER_TYPE_SNMP_GET:
+	case BER_TYPE_SNMP_GETNEXT:
+	case BER_TYPE_SNMP_RESPONSE:
+	case BER_TYPE_SNMP_SET:
+	case BER_TYPE_SNMP_GETBULK:
+	case BER_TYPE_SNMP_INFORM:
+	case BER_TYPE_SNMP_TRAP:
+		*type = packet[*pos];
+		*pos = *pos + 1;
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (*pos >= size)
+		return -1;
+
+	if (!(packet[*pos] & 0x80)) {
+		*len = packet[*pos];
+		*pos = *pos + 1;
+	} else {
+		length_of_len = packet[*pos] & 0x7F;
+		if (length_of_len > 2)
+			return -1;
+
+		*pos = *pos + 1;
+		*len = 0;
+		while (length_of_len--) {
+			if (*pos >= size)
+				return -1;
+
+			*len = (*len << 8) + packet[*pos];
+			*pos = *pos + 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The table-driven decode_len() must accept and reject exactly what the
+ * switch it replaced did, at every offset of valid, mangled and random
+ * requests, and has_high_bit() must agree with a byte at a time scan.
+ */
+static void check_decode_len(void)
+{
+	packet_t packet;
+	size_t i, j, k, pos, ref_pos, len, ref_len;
+	int type, ref_type, rc, ref_rc, bits;
+
+	for (i = 0; i < m_packet_list_length + CHECK_NR_PACKETS; i++) {
+		if (i < m_packet_list_length) {
+			packet = m_packet_list[i];
+		} else if (i % 4 == 3) {
+			packet.name = "random";
+			packet.size = random_below(64);
+			for (j = 0; j < packet.size; j++)
+				packet.data[j] = random_below(0x100);
+		} else {
+			random_packet(&packet);
+			if (i & 1)
+				mutate(&packet);
+		}
+
+		for (j = 0; j <= packet.size; j++) {
+			pos = ref_pos = j;
+			rc = decode_len(packet.data, packet.size, &pos, &type, &len);
+			ref_rc = ref_decode_len(packet.data, packet.size, &ref_pos, &ref_type, &ref_len);
+			if (rc != ref_rc) {
+				check_failed("decode_len", rc ? "rejects" : "accepts", &packet);
+				break;
+			}
+			if (!rc && (pos != ref_pos || type != ref_type || len != ref_len)) {
+				check_failed("decode_len", "decodes differently", &packet);
+				break;
+			}
+		}
+
+		/* From all alignments, in turn */
+		for (j = k = i % 8, bits = 0; j < packet.size; j++) {
+			bits |= packet.data[j];
+			if (has_high_bit(&packet.data[k], j + 1 - k) != !!(bits & 0x80)) {
+				check_failed("has_high_bit", "differs from bytewise", &packet);
+				break;
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	packet_t none = { "none", { 0 }, 0 };
+	packet_t sources = { "4096_sources", { 0 }, 0 };
+	packet_t spoofed = { "1M_sources", { 0 }, 0 };
+	client_t client;
+	size_t i, pos;
+	int type;
+
+	/* JSON on the original stdout, anything the codec logs to /dev/null */
+	m_json = fdopen(dup(STDOUT_FILENO), "w");
+	if (!m_json)
+		return 1;
+	dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+	g_level = LOG_NOTICE;
+
+	add_packets();
+
+	check_bounds();
+	check_decode_len();
+	check_rewrite();
+	if (argc > 1 && !strcmp(argv[1], "check"))
+		return m_failed;
+
+	fprintf(m_json, "{\n  \"benchmarks\": [");
+	for (i = 0; i < m_packet_list_length; i++) {
+		const packet_t *packet = &m_packet_list[i];
+
+		run_hot("snmp", op_snmp, packet, 1000);
+		run_hot("decode_snmp_request", op_decode, packet, 1000);
+		run_hot("snmp_packet_complete", op_complete, packet, 1000);
+		if (prepare_response(packet, &client) == -1)
+			continue;
+		run_hot("encode_snmp_response", op_encode, packet, 1000);
+		run_hot("rewrite_snmp_response", op_rewrite, packet, 1000);
+	}
+
+	/* An eleven subid OID, as decoded by the full encoder */
+	prepare_response(&m_packet_list[0], &client);
+	pos = m_request_copy.varbind_list[0].oid.pos;
+	decode_len(client.packet, client.size, &pos, &type, &i);
+	decode_oid(client.packet, client.size, &pos, i, &m_oid);
+	run("encode_snmp_oid", op_encode_oid, &none, 1000);
+
+	/* Sources that all have a bucket, then far more than there are buckets */
+	g_rate_limit = g_rate_burst = 1000;
+	m_nr_sources = 4096;
+	run("ratelimit", op_ratelimit, &sources, 1000);
+	m_nr_sources = 1 << 20;
+	run("ratelimit", op_ratelimit, &spoofed, 1000);
+
+	/* Queued to the log writer, which gets to drain between batches */
+	g_level = LOG_INFO;
+	log_start(0);
+	run("logit", op_logit, &none, 512);
+	g_level = LOG_NOTICE;
+	fprintf(m_json, "\n  ]\n}\n");
+	fclose(m_json);
+
+	return m_failed;
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -0,0 +1,1014 @@
+/* Load generator, built with 'make blast'
+ *
+ * Floods a running snmpbug with requests over many UDP sockets, each with
+ * its own source port, batched with sendmmsg()/recvmmsg(), or over a set
+ * of TCP connections.  Communities, request types and varbind counts are
+ * drawn from what was asked for, or follow the requests of a well known
+ * scanner.  The request ID of every request indexes the time it was sent,
+ * so replies give the round trip latency, requests without a reply within
+ * a second count as lost.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "snmpbug.h"
+
+#define BLAST_MAX_SOCKETS	1024
+#define BLAST_MAX_COMMUNITIES	65536
+#define BLAST_MAX_VARBINDS	50		/* Keeps even a SET within MAX_PACKET_SIZE */
+#define BLAST_RING		1024		/* Requests tracked per socket, power of 2 */
+#define BLAST_TIMEOUT		1000000000	/* ns before a request counts as lost */
+#define BLAST_HIST_SIZE		100000		/* Latency histogram, 1 us per bucket */
+
+#define PROFILE_RANDOM		0
+#define PROFILE_ONESIXTYONE	1
+#define PROFILE_NMAP		2
+#define PROFILE_SNMPWALK	3
+#define PROFILE_BULKWALK	4
+
+typedef struct slot_s {
+	uint64_t            sent;
+	uint32_t            id;
+	int                 pending;
+} slot_t;
+
+typedef struct conn_s {
+	int                 sockfd;
+	uint32_t            seq;
+	size_t              outstanding;
+	slot_t              slot_list[BLAST_RING];
+
+	/* TCP only, one request in flight */
+	unsigned char       in[MAX_PACKET_SIZE];
+	size_t              in_len;
+	const unsigned char *out;
+	size_t              out_len;
+	unsigned char       out_buf[MAX_PACKET_SIZE];
+} conn_t;
+
+typedef struct known_oid_s {
+	const char          *name;
+	unsigned char        len;
+	unsigned char        data[16];
+} known_oid_t;
+
+/* Some of what a scanner or monitoring system asks for */
+static const known_oid_t m_oid_list[] = {
+	{ "sysDescr.0",     8, { 0x2B, 6, 1, 2, 1, 1, 1, 0 } },
+	{ "sysObjectID.0",  8, { 0x2B, 6, 1, 2, 1, 1, 2, 0 } },
+	{ "sysUpTime.0",    8, { 0x2B, 6, 1, 2, 1, 1, 3, 0 } },
+	{ "sysContact.0",   8, { 0x2B, 6, 1, 2, 1, 1, 4, 0 } },
+	{ "sysName.0",      8, { 0x2B, 6, 1, 2, 1, 1, 5, 0 } },
+	{ "sysLocation.0",  8, { 0x2B, 6, 1, 2, 1, 1, 6, 0 } },
+	{ "ifNumber.0",     8, { 0x2B, 6, 1, 2, 1, 2, 1, 0 } },
+	{ "ifDescr.1",     10, { 0x2B, 6, 1, 2, 1, 2, 2, 1, 2, 1 } },
+	{ "ifInOctets.1",  10, { 0x2B, 6, 1, 2, 1, 2, 2, 1, 10, 1 } },
+	{ "ifOutOctets.1", 10, { 0x2B, 6, 1, 2, 1, 2, 2, 1, 16, 1 } },
+	{ "hrSystemUptime.0", 9, { 0x2B, 6, 1, 2, 1, 25, 1, 1, 0 } },
+	{ "ifHCInOctets.1", 11, { 0x2B, 6, 1, 2, 1, 31, 1, 1, 1, 6, 1 } },
+};
+
+static const known_oid_t m_mib2 = { "mib-2", 5, { 0x2B, 6, 1, 2, 1 } };
+
+/* The first words of the usual community dictionaries */
+static const char *m_default_communities[] = {
+	"public", "private", "community", "manager", "admin", "cisco", "snmp",
+	"monitor", "read", "write", "secret", "default", "router", "switch",
+	"network", "snmpd", "test", "guest", "ILMI", "0", "1234", "all private",
+};
+
+static char            *m_prognm;
+static const char      *m_address = "127.0.0.1";
+static int              m_port = 161;
+static int              m_tcp;
+static int              m_duration = 5;
+static unsigned long    m_rate;
+static size_t           m_nr_sockets = 16;
+static size_t           m_nr_sources;		/* Loopback addresses to send from, 0 for any */
+static size_t           m_window = 32;
+static size_t           m_batch = DEFAULT_UDP_BATCH;
+static int              m_profile = PROFILE_RANDOM;
+static int              m_version = -1;		/* Both */
+static int              m_type_list[4] = { BER_TYPE_SNMP_GET };
+static size_t           m_type_list_length = 1;
+static size_t           m_min_varbinds = 1;
+static size_t           m_max_varbinds = 1;
+
+static const char     **m_community_list = m_default_communities;
+static size_t           m_community_list_length = NELEMS(m_default_communities);
+static size_t           m_community_next;
+
+static conn_t          *m_conn_list;
+static uint64_t         m_random = 0x9E3779B97F4A7C15ULL;
+
+static unsigned long    m_sent;
+static unsigned long    m_replies;
+static unsigned long    m_lost;
+static unsigned long    m_stale;
+static unsigned long    m_bad;
+static unsigned long    m_errors;
+static unsigned long    m_hist[BLAST_HIST_SIZE + 1];
+static uint64_t         m_max_latency;
+
+static int usage(int rc)
+{
+	printf("Usage: %s [options]\n"
+	       "\n"
+	       "  -a, --address ADDR     Address of the snmpbug to flood, default: 127.0.0.1\n"
+	       "  -b, --batch NUM        Datagrams per sendmmsg()/recvmmsg(), default: %d\n"
+	       "  -C, --communities FILE Community dictionary, one per line, default: built-in\n"
+	       "  -d, --duration SEC     Seconds to send requests, default: 5\n"
+	       "  -h, --help             This help text\n"
+	       "  -n, --varbinds MIN[-MAX] Varbinds per request, at most %d, default: 1\n"
+	       "  -p, --port PORT        Port to send to, default: 161\n"
+	       "  -P, --profile NAME     Requests of a scanner: onesixtyone, nmap, snmpwalk, bulkwalk\n"
+	       "  -r, --rate NUM         Requests per second, default: as many as are answered\n"
+	       "  -s, --sockets NUM      UDP sockets (source ports) or TCP connections, default: 16\n"
+	       "  -S, --sources NUM      Send from NUM addresses from 127.0.0.1 up, default: any\n"
+	       "  -t, --tcp              Send over TCP, one request in flight per connection\n"
+	       "  -T, --types LIST       Request types, of get,getnext,getbulk,set, default: get\n"
+	       "  -V, --snmp-version VER SNMP version, 1, 2c or both, default: both\n"
+	       "  -w, --window NUM       Requests in flight per UDP socket, default: 32\n"
+	       "\n", m_prognm, DEFAULT_UDP_BATCH, BLAST_MAX_VARBINDS);
+
+	return rc;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64*, good enough to pick communities and types */
+static uint32_t rnd(void)
+{
+	m_random ^= m_random >> 12;
+	m_random ^= m_random << 25;
+	m_random ^= m_random >> 27;
+
+	return (m_random * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+/*
+ * Request builder, BER written backwards from the end of the buffer so
+ * every header is written after the length it covers is known.
+ */
+
+static unsigned char *put_len(unsigned char *p, size_t len)
+{
+	if (len < 0x80) {
+		*--p = len;
+	} else if (len < 0x100) {
+		*--p = len;
+		*--p = 0x81;
+	} else {
+		*--p = len & 0xFF;
+		*--p = len >> 8;
+		*--p = 0x82;
+	}
+
+	return p;
+}
+
+static unsigned char *put_hdr(unsigned char *p, int type, size_t len)
+{
+	p = put_len(p, len);
+	*--p = type;
+
+	return p;
+}
+
+static unsigned char *put_bytes(unsigned char *p, int type, const void *data, size_t len)
+{
+	p -= len;
+	memcpy(p, data, len);
+
+	return put_hdr(p, type, len);
+}
+
+static unsigned char *put_int(unsigned char *p, uint32_t value)
+{
+	unsigned char *end = p;
+
+	do {
+		*--p = value & 0xFF;
+		value >>= 8;
+	} while (value);
+	if (*p & 0x80)
+		*--p = 0;
+
+	return put_hdr(p, BER_TYPE_INTEGER, end - p);
+}
+
+static const char *next_community(void)
+{
+	/* Scanners try their dictionary in order, others pick at random */
+	switch (m_profile) {
+	case PROFILE_ONESIXTYONE:
+	case PROFILE_NMAP:
+		return m_community_list[m_community_next++ % m_community_list_length];
+
+	case PROFILE_SNMPWALK:
+	case PROFILE_BULKWALK:
+		return m_community_list[0];
+
+	default:
+		return m_community_list[rnd() % m_community_list_length];
+	}
+}
+
+/* Build a request with the given ID ending at end, returns where it starts */
+static unsigned char *build_request(unsigned char *end, uint32_t id)
+{
+	static const unsigned char value[] = "snmpbug-blast";
+	const char *community = next_community();
+	const known_oid_t *oid;
+	unsigned char *p = end, *pdu, *vbl;
+	size_t i, nr_varbinds = 1, first = 0;
+	int version, type;
+	uint32_t a = 0, b = 0;
+
+	switch (m_profile) {
+	case PROFILE_ONESIXTYONE:
+		version = SNMP_VERSION_1;
+		type = BER_TYPE_SNMP_GET;
+		oid = &m_oid_list[0];		/* sysDescr.0 */
+		break;
+
+	case PROFILE_NMAP:
+		version = SNMP_VERSION_1;
+		type = BER_TYPE_SNMP_GET;
+		oid = &m_oid_list[2];		/* sysUpTime.0 */
+		break;
+
+	case PROFILE_SNMPWALK:
+		version = SNMP_VERSION_2C;
+		type = BER_TYPE_SNMP_GETNEXT;
+		oid = &m_mib2;
+		break;
+
+	case PROFILE_BULKWALK:
+		version = SNMP_VERSION_2C;
+		type = BER_TYPE_SNMP_GETBULK;
+		oid = &m_mib2;
+		b = 10;
+		break;
+
+	default:
+		type = m_type_list[rnd() % m_type_list_length];
+		if (m_version >= 0)
+			version = m_version;
+		else
+			version = rnd() & 1 ? SNMP_VERSION_2C : SNMP_VERSION_1;
+		if (type == BER_TYPE_SNMP_GETBULK) {
+			version = SNMP_VERSION_2C;	/* There is no v1 GETBULK */
+			b = 10;
+		}
+		nr_varbinds = m_min_varbinds + rnd() % (m_max_varbinds - m_min_varbinds + 1);
+		first = rnd();
+		oid = NULL;
+		break;
+	}
+
+	for (i = nr_varbinds; i-- > 0; ) {
+		unsigned char *vb = p;
+		const known_oid_t *o = oid ? oid : &m_oid_list[(first + i) % NELEMS(m_oid_list)];
+
+		if (type == BER_TYPE_SNMP_SET)
+			p = put_bytes(p, BER_TYPE_OCTET_STRING, value, sizeof(value) - 1);
+		else
+			p = put_hdr(p, BER_TYPE_NULL, 0);
+		p = put_bytes(p, BER_TYPE_OID, o->data, o->len);
+		p = put_hdr(p, BER_TYPE_SEQUENCE, vb - p);
+	}
+	vbl = p;
+	p = put_hdr(p, BER_TYPE_SEQUENCE, end - vbl);
+
+	/* Error status and index, or non-repeaters and max-repetitions */
+	p = put_int(p, b);
+	p = put_int(p, a);
+	p = put_int(p, id);
+	pdu = p;
+	p = put_hdr(p, type, end - pdu);
+
+	p = put_bytes(p, BER_TYPE_OCTET_STRING, community, strlen(community));
+	p = put_int(p, version);
+	p = put_hdr(p, BER_TYPE_SEQUENCE, end - p);
+
+	return p;
+}
+
+/*
+ * Reply parser, only as far as the request ID
+ */
+
+static int get_tlv(const unsigned char *buf, size_t size, size_t *pos, int *type, size_t *len)
+{
+	size_t n;
+
+	if (*pos + 2 > size)
+		return -1;
+
+	*type = buf[(*pos)++];
+	*len = buf[(*pos)++];
+	if (*len & 0x80) {
+		n = *len & 0x7F;
+		if (n < 1 || n > 2 || *pos + n > size)
+			return -1;
+		*len = buf[(*pos)++];
+		if (n == 2)
+			*len = (*len << 8) | buf[(*pos)++];
+	}
+
+	return 0;
+}
+
+/* Total size of the message at buf, 0 if more is needed to tell */
+static size_t message_size(const unsigned char *buf, size_t size)
+{
+	size_t pos = 0, len;
+	int type;
+
+	if (get_tlv(buf, size, &pos, &type, &len) == -1)
+		return 0;
+
+	return pos + len;
+}
+
+static int parse_reply(const unsigned char *buf, size_t size, uint32_t *id)
+{
+	size_t pos = 0, len, i;
+	int type;
+
+	if (get_tlv(buf, size, &pos, &type, &len) == -1 || type != BER_TYPE_SEQUENCE)
+		return -1;
+	if (get_tlv(buf, size, &pos, &type, &len) == -1 || type != BER_TYPE_INTEGER)
+		return -1;
+	pos += len;
+	if (get_tlv(buf, size, &pos, &type, &len) == -1 || type != BER_TYPE_OCTET_STRING)
+		return -1;
+	pos += len;
+	if (get_tlv(buf, size, &pos, &type, &len) == -1 || type != BER_TYPE_SNMP_RESPONSE)
+		return -1;
+	if (get_tlv(buf, size, &pos, &type, &len) == -1 || type != BER_TYPE_INTEGER)
+		return -1;
+	if (len < 1 || len > 5 || pos + len > size)
+		return -1;
+
+	for (i = 0, *id = 0; i < len; i++)
+		*id = (*id << 8) | buf[pos + i];
+
+	return 0;
+}
+
+/*
+ * Request bookkeeping
+ */
+
+/* Take the next request ID of a connection and note when it is sent */
+static uint32_t track_request(conn_t *conn, uint64_t now)
+{
+	uint32_t id = conn->seq++ & 0x7FFFFFFF;
+	slot_t *slot = &conn->slot_list[id & (BLAST_RING - 1)];
+
+	/* Still waiting for the request sent BLAST_RING ago, give up on it */
+	if (slot->pending) {
+		m_lost++;
+		conn->outstanding--;
+	}
+
+	slot->id = id;
+	slot->sent = now;
+	slot->pending = 1;
+	conn->outstanding++;
+
+	return id;
+}
+
+static void untrack_request(conn_t *conn, uint32_t id)
+{
+	slot_t *slot = &conn->slot_list[id & (BLAST_RING - 1)];
+
+	slot->pending = 0;
+	conn->outstanding--;
+	conn->seq--;
+}
+
+static void handle_reply(conn_t *conn, const unsigned char *buf, size_t len, uint64_t now)
+{
+	slot_t *slot;
+	uint64_t us;
+	uint32_t id;
+
+	if (parse_reply(buf, len, &id) == -1) {
+		m_bad++;
+		return;
+	}
+
+	slot = &conn->slot_list[id & (BLAST_RING - 1)];
+	if (!slot->pending || slot->id != id) {
+		m_stale++;
+		return;
+	}
+
+	slot->pending = 0;
+	conn->outstanding--;
+	m_replies++;
+
+	if (now - slot->sent > m_max_latency)
+		m_max_latency = now - slot->sent;
+	us = (now - slot->sent) / 1000;
+	m_hist[us < BLAST_HIST_SIZE ? us : BLAST_HIST_SIZE]++;
+}
+
+/* Count the requests that went unanswered for too long, returns how many */
+static size_t expire_requests(conn_t *conn, uint64_t now)
+{
+	size_t i, n = 0;
+
+	if (!conn->outstanding)
+		return 0;
+
+	for (i = 0; i < BLAST_RING; i++) {
+		slot_t *slot = &conn->slot_list[i];
+
+		if (slot->pending && now - slot->sent >= BLAST_TIMEOUT) {
+			slot->pending = 0;
+			conn->outstanding--;
+			n++;
+		}
+	}
+	m_lost += n;
+
+	return n;
+}
+
+/*
+ * Connections
+ */
+
+static int open_conn(conn_t *conn, const struct sockaddr *sa, socklen_t salen)
+{
+	struct sockaddr_in src;
+	int on = 1;
+
+	conn->sockfd = socket(sa->sa_family, m_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (conn->sockfd == -1)
+		return -1;
+
+	/* All of 127/8 is loopback, so many sources need no setup */
+	if (m_nr_sources) {
+		memset(&src, 0, sizeof(src));
+		src.sin_family = AF_INET;
+		src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + (conn - m_conn_list) % m_nr_sources);
+		if (bind(conn->sockfd, (struct sockaddr *)&src, sizeof(src)) == -1) {
+			close(conn->sockfd);
+			conn->sockfd = -1;
+			return -1;
+		}
+	}
+
+	/* Connected, so each socket keeps its own source port and only sees its replies */
+	if (connect(conn->sockfd, sa, salen) == -1) {
+		close(conn->sockfd);
+		conn->sockfd = -1;
+		return -1;
+	}
+	if (m_tcp)
+		setsockopt(conn->sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	fcntl(conn->sockfd, F_SETFL, fcntl(conn->sockfd, F_GETFL) | O_NONBLOCK);
+
+	conn->in_len = 0;
+	conn->out_len = 0;
+
+	return 0;
+}
+
+/* Send as many requests as window, batch and rate allow, returns how many */
+static size_t send_udp(conn_t *conn, size_t budget, uint64_t now)
+{
+	static unsigned char buf[MAX_UDP_BATCH][MAX_PACKET_SIZE];
+	struct mmsghdr msgs[MAX_UDP_BATCH];
+	struct iovec iovs[MAX_UDP_BATCH];
+	uint32_t id_list[MAX_UDP_BATCH];
+	size_t i, n;
+	int rv;
+
+	n = m_window - conn->outstanding;
+	if (n > m_batch)
+		n = m_batch;
+	if (n > budget)
+		n = budget;
+	if (!n)
+		return 0;
+
+	memset(msgs, 0, n * sizeof(msgs[0]));
+	for (i = 0; i < n; i++) {
+		unsigned char *end = buf[i] + MAX_PACKET_SIZE;
+		unsigned char *p;
+
+		id_list[i] = track_request(conn, now);
+		p = build_request(end, id_list[i]);
+		iovs[i].iov_base = p;
+		iovs[i].iov_len = end - p;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	rv = sendmmsg(conn->sockfd, msgs, n, 0);
+	if (rv < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			m_errors++;
+		rv = 0;
+	}
+
+	/* What did not go out is not waited for */
+	for (i = n; i-- > (size_t)rv; )
+		untrack_request(conn, id_list[i]);
+	m_sent += rv;
+
+	return rv;
+}
+
+static size_t recv_udp(conn_t *conn)
+{
+	static unsigned char buf[MAX_UDP_BATCH][MAX_PACKET_SIZE];
+	struct mmsghdr msgs[MAX_UDP_BATCH];
+	struct iovec iovs[MAX_UDP_BATCH];
+	uint64_t now;
+	size_t i;
+	int rv;
+
+	memset(msgs, 0, m_batch * sizeof(msgs[0]));
+	for (i = 0; i < m_batch; i++) {
+		iovs[i].iov_base = buf[i];
+		iovs[i].iov_len = MAX_PACKET_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	rv = recvmmsg(conn->sockfd, msgs, m_batch, MSG_DONTWAIT, NULL);
+	if (rv < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			m_errors++;
+		return 0;
+	}
+
+	now = now_ns();
+	for (i = 0; i < (size_t)rv; i++)
+		handle_reply(conn, buf[i], msgs[i].msg_len, now);
+
+	return rv;
+}
+
+static size_t send_tcp(conn_t *conn, size_t budget, uint64_t now)
+{
+	unsigned char *end = conn->out_buf + sizeof(conn->out_buf);
+	ssize_t rv;
+	size_t n = 0;
+
+	if (!conn->out_len) {
+		if (conn->outstanding || !budget)
+			return 0;
+		conn->out = build_request(end, track_request(conn, now));
+		conn->out_len = end - conn->out;
+		m_sent++;
+		n = 1;
+	}
+
+	rv = send(conn->sockfd, conn->out, conn->out_len, MSG_NOSIGNAL);
+	if (rv < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			m_errors++;
+		return n;
+	}
+	conn->out += rv;
+	conn->out_len -= rv;
+
+	return n;
+}
+
+/* Returns -1 when the connection is gone */
+static int recv_tcp(conn_t *conn)
+{
+	size_t size;
+	ssize_t rv;
+
+	rv = recv(conn->sockfd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+	if (rv < 0)
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	if (rv == 0)
+		return -1;
+	conn->in_len += rv;
+
+	while ((size = message_size(conn->in, conn->in_len)) && size <= conn->in_len) {
+		handle_reply(conn, conn->in, size, now_ns());
+		memmove(conn->in, conn->in + size, conn->in_len - size);
+		conn->in_len -= size;
+	}
+	if (conn->in_len == sizeof(conn->in))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Main loop
+ */
+
+static void run(struct pollfd *pfds, const struct sockaddr *sa, socklen_t salen)
+{
+	uint64_t start, now, stop, last_expire;
+	size_t i, budget, busy;
+	unsigned long allowed;
+	int sending = 1;
+
+	start = last_expire = now_ns();
+	stop = start + (uint64_t)m_duration * 1000000000;
+
+	while (1) {
+		now = now_ns();
+		if (sending && now >= stop) {
+			/* Give what is still in flight the time to be answered */
+			sending = 0;
+			stop = now + BLAST_TIMEOUT;
+		}
+		if (!sending) {
+			for (i = 0, busy = 0; i < m_nr_sockets; i++)
+				busy += m_conn_list[i].outstanding;
+			if (!busy || now >= stop)
+				break;
+		}
+
+		budget = sending ? (size_t)-1 : 0;
+		if (sending && m_rate) {
+			allowed = (now - start) * m_rate / 1000000000 + 1;
+			budget = allowed > m_sent ? allowed - m_sent : 0;
+		}
+
+		busy = 0;
+		for (i = 0; i < m_nr_sockets; i++) {
+			conn_t *conn = &m_conn_list[i];
+			size_t n;
+
+			if (conn->sockfd == -1)
+				continue;
+			n = m_tcp ? send_tcp(conn, budget, now) : send_udp(conn, budget, now);
+			budget -= n;
+			busy += n;
+		}
+
+		for (i = 0; i < m_nr_sockets; i++) {
+			pfds[i].fd = m_conn_list[i].sockfd;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		if (poll(pfds, m_nr_sockets, busy ? 0 : 1) < 0 && errno != EINTR)
+			break;
+
+		for (i = 0; i < m_nr_sockets; i++) {
+			conn_t *conn = &m_conn_list[i];
+
+			if (!(pfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+			if (!m_tcp) {
+				recv_udp(conn);
+				continue;
+			}
+			if (recv_tcp(conn) == -1) {
+				/* Evicted by the server, what was in flight is lost */
+				m_lost += conn->outstanding;
+				memset(conn->slot_list, 0, sizeof(conn->slot_list));
+				conn->outstanding = 0;
+				close(conn->sockfd);
+				if (!sending || open_conn(conn, sa, salen) == -1) {
+					m_errors++;
+					conn->sockfd = -1;
+				}
+			}
+		}
+
+		now = now_ns();
+		if (now - last_expire >= BLAST_TIMEOUT / 10) {
+			for (i = 0; i < m_nr_sockets; i++)
+				expire_requests(&m_conn_list[i], now);
+			last_expire = now;
+		}
+	}
+
+	for (i = 0; i < m_nr_sockets; i++)
+		m_lost += m_conn_list[i].outstanding;
+}
+
+static double percentile(double p)
+{
+	unsigned long total = 0, want;
+	size_t i;
+
+	for (i = 0; i <= BLAST_HIST_SIZE; i++)
+		total += m_hist[i];
+	if (!total)
+		return 0;
+
+	want = total * p / 100;
+	if (want >= total)
+		want = total - 1;
+	for (i = 0, total = 0; i <= BLAST_HIST_SIZE; i++) {
+		total += m_hist[i];
+		if (total > want)
+			break;
+	}
+
+	return i;
+}
+
+static void report(void)
+{
+	static const char *profiles[] = { "random", "onesixtyone", "nmap", "snmpwalk", "bulkwalk" };
+	double secs = m_duration;
+
+	printf("%s %s port %d, %zu %s, profile %s, %d s\n", m_tcp ? "TCP" : "UDP", m_address, m_port,
+	       m_nr_sockets, m_tcp ? "connections" : "sockets", profiles[m_profile], m_duration);
+	printf("requests  %10lu  %10.0f/s\n", m_sent, m_sent / secs);
+	printf("replies   %10lu  %10.0f/s\n", m_replies, m_replies / secs);
+	printf("lost      %10lu  %10.3f%%\n", m_lost, m_sent ? 100.0 * m_lost / m_sent : 0);
+	if (m_stale || m_bad || m_errors)
+		printf("late %lu, unparsable %lu, socket errors %lu\n", m_stale, m_bad, m_errors);
+	printf("latency   p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n",
+	       percentile(50), percentile(99), percentile(99.9), m_max_latency / 1000.0);
+}
+
+/*
+ * Options
+ */
+
+static int load_communities(const char *file)
+{
+	char line[MAX_STRING_SIZE + 2];
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return -1;
+
+	m_community_list = calloc(BLAST_MAX_COMMUNITIES, sizeof(char *));
+	if (!m_community_list) {
+		fclose(fp);
+		return -1;
+	}
+
+	m_community_list_length = 0;
+	while (fgets(line, sizeof(line), fp) && m_community_list_length < BLAST_MAX_COMMUNITIES) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (!line[0] || line[0] == '#')
+			continue;
+		m_community_list[m_community_list_length++] = strdup(line);
+	}
+	fclose(fp);
+
+	return m_community_list_length ? 0 : -1;
+}
+
+static int parse_types(char *arg)
+{
+	char *type, *save;
+	size_t n = 0;
+
+	for (type = strtok_r(arg, ",", &save); type; type = strtok_r(NULL, ",", &save)) {
+		if (n == NELEMS(m_type_list))
+			return -1;
+		if (!strcmp(type, "get"))
+			m_type_list[n++] = BER_TYPE_SNMP_GET;
+		else if (!strcmp(type, "getnext"))
+			m_type_list[n++] = BER_TYPE_SNMP_GETNEXT;
+		else if (!strcmp(type, "getbulk"))
+			m_type_list[n++] = BER_TYPE_SNMP_GETBULK;
+		else if (!strcmp(type, "set"))
+			m_type_list[n++] = BER_TYPE_SNMP_SET;
+		else
+			return -1;
+	}
+	m_type_list_length = n;
+
+	return n ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char short_options[] = "a:b:C:d:hn:p:P:r:s:S:tT:V:w:";
+	static const struct option long_options[] = {
+		{ "address",      1, 0, 'a' },
+		{ "batch",        1, 0, 'b' },
+		{ "communities",  1, 0, 'C' },
+		{ "duration",     1, 0, 'd' },
+		{ "help",         0, 0, 'h' },
+		{ "varbinds",     1, 0, 'n' },
+		{ "port",         1, 0, 'p' },
+		{ "profile",      1, 0, 'P' },
+		{ "rate",         1, 0, 'r' },
+		{ "sockets",      1, 0, 's' },
+		{ "sources",      1, 0, 'S' },
+		{ "tcp",          0, 0, 't' },
+		{ "types",        1, 0, 'T' },
+		{ "snmp-version", 1, 0, 'V' },
+		{ "window",       1, 0, 'w' },
+		{ NULL, 0, 0, 0 }
+	};
+	struct sockaddr_in6 sin6;
+	struct sockaddr_in sin;
+	struct sockaddr *sa;
+	struct pollfd *pfds;
+	socklen_t salen;
+	size_t i;
+	char *p;
+	int c;
+
+	m_prognm = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+
+	while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			m_address = optarg;
+			break;
+
+		case 'b':
+			m_batch = atoi(optarg);
+			if (m_batch < 1 || m_batch > MAX_UDP_BATCH) {
+				fprintf(stderr, "Invalid batch size, must be 1..%d\n", MAX_UDP_BATCH);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'C':
+			if (load_communities(optarg) == -1) {
+				fprintf(stderr, "Could not read any community from %s\n", optarg);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'd':
+			m_duration = atoi(optarg);
+			if (m_duration < 1) {
+				fprintf(stderr, "Invalid duration, must be at least 1 second\n");
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'h':
+			return usage(0);
+
+		case 'n':
+			m_min_varbinds = m_max_varbinds = strtoul(optarg, &p, 10);
+			if (*p == '-')
+				m_max_varbinds = strtoul(p + 1, NULL, 10);
+			if (m_min_varbinds < 1 || m_max_varbinds < m_min_varbinds || m_max_varbinds > BLAST_MAX_VARBINDS) {
+				fprintf(stderr, "Invalid number of varbinds, must be 1..%d\n", BLAST_MAX_VARBINDS);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'p':
+			m_port = atoi(optarg);
+			break;
+
+		case 'P':
+			if (!strcmp(optarg, "onesixtyone")) {
+				m_profile = PROFILE_ONESIXTYONE;
+			} else if (!strcmp(optarg, "nmap")) {
+				m_profile = PROFILE_NMAP;
+			} else if (!strcmp(optarg, "snmpwalk")) {
+				m_profile = PROFILE_SNMPWALK;
+			} else if (!strcmp(optarg, "bulkwalk")) {
+				m_profile = PROFILE_BULKWALK;
+			} else {
+				fprintf(stderr, "Unknown profile %s\n", optarg);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'r':
+			m_rate = strtoul(optarg, NULL, 10);
+			break;
+
+		case 's':
+			m_nr_sockets = atoi(optarg);
+			if (m_nr_sockets < 1 || m_nr_sockets > BLAST_MAX_SOCKETS) {
+				fprintf(stderr, "Invalid number of sockets, must be 1..%d\n", BLAST_MAX_SOCKETS);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'S':
+			m_nr_sources = atoi(optarg);
+			if (m_nr_sources < 1 || m_nr_sources > BLAST_MAX_SOCKETS) {
+				fprintf(stderr, "Invalid number of sources, must be 1..%d\n", BLAST_MAX_SOCKETS);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 't':
+			m_tcp = 1;
+			break;
+
+		case 'T':
+			if (parse_types(optarg) == -1) {
+				fprintf(stderr, "Invalid request types %s\n", optarg);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'V':
+			if (!strcmp(optarg, "1")) {
+				m_version = SNMP_VERSION_1;
+			} else if (!strcmp(optarg, "2c")) {
+				m_version = SNMP_VERSION_2C;
+			} else if (!strcmp(optarg, "both")) {
+				m_version = -1;
+			} else {
+				fprintf(stderr, "Unknown SNMP version %s, must be 1, 2c or both\n", optarg);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'w':
+			m_window = atoi(optarg);
+			if (m_window < 1 || m_window >= BLAST_RING) {
+				fprintf(stderr, "Invalid window, must be 1..%d\n", BLAST_RING - 1);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		default:
+			return usage(EXIT_ARGS);
+		}
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	memset(&sin6, 0, sizeof(sin6));
+	if (inet_pton(AF_INET, m_address, &sin.sin_addr) == 1) {
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(m_port);
+		sa = (struct sockaddr *)&sin;
+		salen = sizeof(sin);
+	} else if (inet_pton(AF_INET6, m_address, &sin6.sin6_addr) == 1) {
+		sin6.sin6_family = AF_INET6;
+		sin6.sin6_port = htons(m_port);
+		sa = (struct sockaddr *)&sin6;
+		salen = sizeof(sin6);
+	} else {
+		fprintf(stderr, "Invalid address %s\n", m_address);
+		return usage(EXIT_ARGS);
+	}
+	if (m_nr_sources && sa->sa_family != AF_INET) {
+		fprintf(stderr, "Sending from several sources needs an IPv4 address\n");
+		return usage(EXIT_ARGS);
+	}
+
+	m_random ^= now_ns() ^ getpid();
+	m_conn_list = calloc(m_nr_sockets, sizeof(conn_t));
+	pfds = calloc(m_nr_sockets, sizeof(struct pollfd));
+	if (!m_conn_list || !pfds) {
+		perror("could not allocate sockets");
+		return EXIT_SYSCALL;
+	}
+
+	for (i = 0; i < m_nr_sockets; i++) {
+		m_conn_list[i].seq = rnd();
+		if (open_conn(&m_conn_list[i], sa, salen) == -1) {
+			fprintf(stderr, "could not connect to %s port %d: %s\n", m_address, m_port, strerror(errno));
+			return EXIT_SYSCALL;
+		}
+	}
+
+	run(pfds, sa, salen);
+	report();
+
+	return EXIT_OK;
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
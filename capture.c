@@ -0,0 +1,333 @@
+/* Passive capture
+ *
+ * Logs the communities of SNMP requests seen on an interface, typically a
+ * SPAN or mirror port, without ever answering them.  Frames are read from
+ * a TPACKET_V3 ring shared with the kernel, which hands over whole blocks
+ * of frames at once, so a busy port costs one poll() per block instead of
+ * one syscall per packet.  The Ethernet/IP/UDP parsing is kept apart from
+ * the ring so other frame sources can use it as well.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif
+
+#include "snmpbug.h"
+
+#ifndef ETHERTYPE_QINQ
+#define ETHERTYPE_QINQ		0x88A8
+#endif
+
+#define ETH_HLEN_MIN		14
+#define VLAN_HLEN		4
+#define IPV4_HLEN_MIN		20
+#define IPV6_HLEN		40
+#define UDP_HLEN		8
+
+static int parse_udp(const unsigned char *udp, size_t len, client_t *client)
+{
+	size_t udp_len;
+
+	if (len < UDP_HLEN)
+		return -1;
+
+	/* Destination port, only requests to the port we'd be serving */
+	if (((udp[2] << 8) | udp[3]) != g_udp_port)
+		return -1;
+
+	/* The captured part may be shorter, the UDP length never longer */
+	udp_len = (udp[4] << 8) | udp[5];
+	if (udp_len < UDP_HLEN)
+		return -1;
+	if (udp_len < len)
+		len = udp_len;
+
+	len -= UDP_HLEN;
+	if (len > sizeof(client->packet))
+		len = sizeof(client->packet);
+
+	memcpy(&client->port, &udp[0], sizeof(client->port));
+	memcpy(client->packet, &udp[UDP_HLEN], len);
+	client->size = len;
+
+	return 0;
+}
+
+static int parse_ipv4(const unsigned char *ip, size_t len, client_t *client)
+{
+	size_t hlen, tot_len;
+
+	if (len < IPV4_HLEN_MIN || (ip[0] >> 4) != 4)
+		return -1;
+
+	hlen = (ip[0] & 0x0F) * 4;
+	tot_len = (ip[2] << 8) | ip[3];
+	if (hlen < IPV4_HLEN_MIN || tot_len < hlen || len < hlen)
+		return -1;
+	if (tot_len < len)
+		len = tot_len;	/* Ethernet padding */
+
+	/* Fragments never carry a complete request, skip them */
+	if (((ip[6] << 8) | ip[7]) & 0x3FFF)
+		return -1;
+	if (ip[9] != IPPROTO_UDP)
+		return -1;
+
+	/* Store the source as an IPv4 mapped address, like our sockets do */
+	memset(&client->addr, 0, sizeof(client->addr));
+	client->addr.s6_addr[10] = 0xFF;
+	client->addr.s6_addr[11] = 0xFF;
+	memcpy(&client->addr.s6_addr[12], &ip[12], 4);
+	client->local_addr = client->addr;
+	memcpy(&client->local_addr.s6_addr[12], &ip[16], 4);
+
+	return parse_udp(ip + hlen, len - hlen, client);
+}
+
+static int parse_ipv6(const unsigned char *ip, size_t len, client_t *client)
+{
+	size_t pos, payload_len;
+	int next;
+
+	if (len < IPV6_HLEN || (ip[0] >> 4) != 6)
+		return -1;
+
+	payload_len = (ip[4] << 8) | ip[5];
+	if (payload_len + IPV6_HLEN < len)
+		len = payload_len + IPV6_HLEN;
+
+	/* Skip the extension headers that may come before UDP, but not fragments */
+	next = ip[6];
+	pos = IPV6_HLEN;
+	while (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING || next == IPPROTO_DSTOPTS) {
+		if (pos + 2 > len)
+			return -1;
+		next = ip[pos];
+		pos += (ip[pos + 1] + 1) * 8;
+	}
+	if (next != IPPROTO_UDP || pos > len)
+		return -1;
+
+	memcpy(&client->addr, &ip[8], sizeof(client->addr));
+	memcpy(&client->local_addr, &ip[24], sizeof(client->local_addr));
+
+	return parse_udp(ip + pos, len - pos, client);
+}
+
+/* Same for an IP packet without link layer header, either version */
+int capture_parse_ip(const unsigned char *ip, size_t len, client_t *client)
+{
+	if (len < 1)
+		return -1;
+	if ((ip[0] >> 4) == 4)
+		return parse_ipv4(ip, len, client);
+	if ((ip[0] >> 4) == 6)
+		return parse_ipv6(ip, len, client);
+
+	return -1;
+}
+
+/*
+ * Find the SNMP request in an Ethernet frame, returns 0 and fills in the
+ * address, port and packet of the client if there is one for our port.
+ */
+int capture_parse_frame(const unsigned char *frame, size_t len, client_t *client)
+{
+	size_t pos = 12;
+	int type;
+
+	if (len < ETH_HLEN_MIN)
+		return -1;
+
+	type = (frame[pos] << 8) | frame[pos + 1];
+	while (type == ETHERTYPE_VLAN || type == ETHERTYPE_QINQ) {
+		pos += VLAN_HLEN;
+		if (pos + 2 > len)
+			return -1;
+		type = (frame[pos] << 8) | frame[pos + 1];
+	}
+	pos += 2;
+
+	if (type == ETHERTYPE_IP)
+		return parse_ipv4(frame + pos, len - pos, client);
+	if (type == ETHERTYPE_IPV6)
+		return parse_ipv6(frame + pos, len - pos, client);
+
+	return -1;
+}
+
+#ifdef TPACKET3_HDRLEN
+
+#define CAPTURE_BLOCK_SIZE	(1 << 20)
+#define CAPTURE_NR_BLOCKS	64
+#define CAPTURE_FRAME_SIZE	2048
+#define CAPTURE_BLOCK_TIMEOUT	60	/* ms before a partly filled block is handed over */
+
+static int            capture_sockfd = -1;
+static unsigned char *capture_ring;
+static client_t       capture_client;
+
+int capture_open(const char *ifname)
+{
+	struct tpacket_req3 req;
+	struct packet_mreq mreq;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V3;
+	unsigned int ifindex;
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex) {
+		logit(LOG_ERR, errno, "could not find capture interface %s", ifname);
+		exit(EXIT_SYSCALL);
+	}
+
+	capture_sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (capture_sockfd == -1) {
+		logit(LOG_ERR, errno, "could not create capture socket");
+		exit(EXIT_SYSCALL);
+	}
+
+	if (setsockopt(capture_sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+		logit(LOG_ERR, errno, "could not select TPACKET_V3 on capture socket");
+		exit(EXIT_SYSCALL);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = CAPTURE_BLOCK_SIZE;
+	req.tp_block_nr = CAPTURE_NR_BLOCKS;
+	req.tp_frame_size = CAPTURE_FRAME_SIZE;
+	req.tp_frame_nr = CAPTURE_BLOCK_SIZE / CAPTURE_FRAME_SIZE * CAPTURE_NR_BLOCKS;
+	req.tp_retire_blk_tov = CAPTURE_BLOCK_TIMEOUT;
+	if (setsockopt(capture_sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+		logit(LOG_ERR, errno, "could not set up capture ring");
+		exit(EXIT_SYSCALL);
+	}
+
+	capture_ring = mmap(NULL, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_NR_BLOCKS,
+			    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, capture_sockfd, 0);
+	if (capture_ring == MAP_FAILED)
+		capture_ring = mmap(NULL, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_NR_BLOCKS,
+				    PROT_READ | PROT_WRITE, MAP_SHARED, capture_sockfd, 0);
+	if (capture_ring == MAP_FAILED) {
+		logit(LOG_ERR, errno, "could not map capture ring");
+		exit(EXIT_SYSCALL);
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex;
+	if (bind(capture_sockfd, (struct sockaddr *)&sll, sizeof(sll)) == -1) {
+		logit(LOG_ERR, errno, "could not bind capture socket to %s", ifname);
+		exit(EXIT_SYSCALL);
+	}
+
+	/* A mirror port delivers frames for other hosts */
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = ifindex;
+	mreq.mr_type = PACKET_MR_PROMISC;
+	if (setsockopt(capture_sockfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+		logit(LOG_WARNING, errno, "could not set %s in promiscuous mode", ifname);
+
+	return 0;
+}
+
+static void capture_block(struct tpacket_block_desc *block)
+{
+	struct tpacket3_hdr *hdr;
+	struct sockaddr_ll *sll;
+	uint32_t i;
+
+	hdr = (struct tpacket3_hdr *)((unsigned char *)block + block->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+		/* Our own transmissions are not what we are here to see */
+		sll = (struct sockaddr_ll *)((unsigned char *)hdr + TPACKET_ALIGN(sizeof(*hdr)));
+		if (sll->sll_pkttype != PACKET_OUTGOING &&
+		    capture_parse_frame((unsigned char *)hdr + hdr->tp_mac, hdr->tp_snaplen, &capture_client) == 0) {
+			capture_client.timestamp = hdr->tp_sec;
+			capture_client.timestamp_nsec = hdr->tp_nsec;
+			snmp_sniff(&capture_client);
+		}
+
+		hdr = (struct tpacket3_hdr *)((unsigned char *)hdr + hdr->tp_next_offset);
+	}
+}
+
+void run_capture(void)
+{
+	struct tpacket_block_desc *block;
+	struct tpacket_stats_v3 stats;
+	struct pollfd pfd;
+	socklen_t len;
+	size_t current = 0;
+
+	pfd.fd = capture_sockfd;
+	pfd.events = POLLIN | POLLERR;
+
+	while (!g_quit) {
+		latency_poll();
+		block = (struct tpacket_block_desc *)(capture_ring + current * CAPTURE_BLOCK_SIZE);
+		if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+			pfd.revents = 0;
+			if (poll(&pfd, 1, g_timeout * 10) == -1 && errno != EINTR) {
+				logit(LOG_ERR, errno, "could not wait for captured packets");
+				break;
+			}
+			aggregate_flush(time(NULL), 0);
+			continue;
+		}
+
+		capture_block(block);
+
+		/* Hand the block back to the kernel */
+		__atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		current = (current + 1) % CAPTURE_NR_BLOCKS;
+	}
+
+	aggregate_flush(time(NULL), 1);
+
+	len = sizeof(stats);
+	if (getsockopt(capture_sockfd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0)
+		logit(LOG_NOTICE, 0, "Captured %u packets, %u dropped by kernel", stats.tp_packets, stats.tp_drops);
+
+	munmap(capture_ring, (size_t)CAPTURE_BLOCK_SIZE * CAPTURE_NR_BLOCKS);
+	close(capture_sockfd);
+}
+
+#else /* !TPACKET3_HDRLEN */
+
+int capture_open(const char UNUSED(*ifname))
+{
+	logit(LOG_ERR, 0, "passive capture is not supported by this build");
+	exit(EXIT_ARGS);
+}
+
+void run_capture(void)
+{
+}
+
+#endif /* TPACKET3_HDRLEN */
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -22,21 +22,49 @@ int       g_family  = AF_INET6;
 int       g_timeout = 1;
 int       g_auth    = 1;	/* always enable auth, for logging */
 int       g_level   = LOG_INFO;	/* to log that auth info */
+int       g_engine  = ENGINE_EPOLL;
+int       g_transparent;	/* Answer for addresses not configured on any interface */
 volatile sig_atomic_t g_quit = 0;
 
 char     *g_prognm;
 char     *g_bind_to_device;
+char     *g_sniff_device;
+char     *g_read_pcap;
 char     *g_user;
 
 char     *g_interface_list[MAX_NR_INTERFACES];
 size_t    g_interface_list_length;
 
-int       g_udp_sockfd = -1;
-int       g_tcp_sockfd = -1;
+in_port_t g_udp_port;
+in_port_t g_tcp_port;
 
-client_t  g_udp_client;
-client_t *g_tcp_client_list[MAX_NR_CLIENTS];
-size_t    g_tcp_client_list_length;
+size_t    g_udp_batch   = DEFAULT_UDP_BATCH;
+size_t    g_udp_queue;		/* Requests the socket buffers should hold, 0 for the system default */
+size_t    g_max_clients = DEFAULT_NR_CLIENTS;
+
+size_t    g_aggregate_size    = DEFAULT_NR_AGGREGATES;
+int       g_summary_interval  = DEFAULT_SUMMARY_INTERVAL;
+
+uint32_t  g_rate_limit;		/* Requests per second and source, 0 for no limit */
+uint32_t  g_rate_burst;
+
+int       g_busy_poll;		/* us to spin for requests before sleeping, 0 to never spin */
+int       g_cpu_list[MAX_NR_WORKERS];
+size_t    g_cpu_list_length;
+
+worker_t *g_worker_list;
+size_t    g_worker_list_length = 1;
+
+/* Threads without a block of their own count here, e.g. before stats_open() */
+static stats_t    stats_none;
+stats_segment_t  *g_stats_segment;
+__thread stats_t *g_stats = &stats_none;
+
+/* Set by SIGUSR1, the main thread logs the histograms on its next wakeup */
+volatile sig_atomic_t g_latency_dump;
+
+static latency_t    latency_none;
+__thread latency_t *g_latency = &latency_none;
 
 /* vim: ts=4 sts=4 sw=4 nowrap
  */
@@ -0,0 +1,148 @@
+/* Request latency
+ *
+ * Where the time of a request goes: every thread counts how long each
+ * phase took (receiving, decoding, logging, handling, encoding, sending)
+ * in histograms of its own, with buckets growing with the power of 2 of
+ * the duration and 32 linear steps within each, so their memory is fixed
+ * and no sample is more than 3% off.  Durations are in clock ticks, the
+ * TSC on x86, converted to ns only when the histograms are logged, on
+ * SIGUSR1 and at exit.  The system calls are timed for every batch, the
+ * phases of the requests themselves for one in LATENCY_SAMPLE.
+ *
+ * How long a datagram waited in the socket queue and how long it took
+ * until its reply was sent are measured in ns from the time the kernel
+ * stamped it with when it arrived, for every datagram.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "snmpbug.h"
+
+#ifndef NO_LATENCY
+
+static latency_t       *latency_list;
+static size_t           latency_list_length;
+static uint64_t         latency_start_ticks;
+static uint64_t         latency_start_ns;
+
+static uint64_t latency_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int latency_open(size_t nr_threads)
+{
+	if (posix_memalign((void **)&latency_list, 64, nr_threads * sizeof(latency_t)))
+		return -1;
+	memset(latency_list, 0, nr_threads * sizeof(latency_t));
+	latency_list_length = nr_threads;
+
+	/* The tick rate is measured against the monotonic clock over the whole run */
+	latency_start_ticks = latency_clock();
+	latency_start_ns = latency_ns();
+
+	return 0;
+}
+
+/* Have the calling thread count in histograms id from now on */
+void latency_thread(size_t id)
+{
+	if (id < latency_list_length)
+		g_latency = &latency_list[id];
+}
+
+/* The middle of what a bucket holds, in ticks */
+static double latency_value(size_t i)
+{
+	int shift;
+
+	if (i < (1 << LATENCY_SUB_BITS))
+		return i;
+
+	shift = (i >> LATENCY_SUB_BITS) - 1;
+	return (double)(((i & ((1 << LATENCY_SUB_BITS) - 1)) + (1 << LATENCY_SUB_BITS)) << shift) +
+	       (double)(1ULL << shift) / 2;
+}
+
+static double latency_percentile(const uint64_t *bucket, uint64_t total, double p)
+{
+	uint64_t rank = total * p / 100, sum = 0;
+	size_t i;
+
+	if (rank >= total)
+		rank = total - 1;
+	for (i = 0; i < LATENCY_NR_BUCKETS; i++) {
+		sum += bucket[i];
+		if (sum > rank)
+			break;
+	}
+
+	return latency_value(i);
+}
+
+/* Log the percentiles of every phase, summed over all threads */
+void latency_dump(void)
+{
+	static const char *phases[LATENCY_NR_PHASES] = {
+		"queue", "recv", "decode", "log", "handle", "encode", "send", "response"
+	};
+	uint64_t bucket[LATENCY_NR_BUCKETS];
+	uint64_t total, ticks;
+	double ns_per_tick = 1, scale;
+	size_t i, j, t, max;
+
+	ticks = latency_clock() - latency_start_ticks;
+	if (ticks)
+		ns_per_tick = (double)(latency_ns() - latency_start_ns) / ticks;
+
+	for (i = 0; i < LATENCY_NR_PHASES; i++) {
+		memset(bucket, 0, sizeof(bucket));
+		for (t = 0; t < latency_list_length; t++) {
+			for (j = 0; j < LATENCY_NR_BUCKETS; j++)
+				bucket[j] += __atomic_load_n(&latency_list[t].bucket_list[i][j], __ATOMIC_RELAXED);
+		}
+
+		for (j = 0, total = 0, max = 0; j < LATENCY_NR_BUCKETS; j++) {
+			total += bucket[j];
+			if (bucket[j])
+				max = j;
+		}
+		if (!total)
+			continue;
+		scale = i == LATENCY_QUEUE || i == LATENCY_RESPONSE ? 1 : ns_per_tick;
+
+		logit(LOG_NOTICE, 0, "Latency of %s: %llu samples, p50 %.0f ns, p90 %.0f ns, "
+		      "p99 %.0f ns, p99.9 %.0f ns, max %.0f ns", phases[i], (unsigned long long)total,
+		      latency_percentile(bucket, total, 50) * scale,
+		      latency_percentile(bucket, total, 90) * scale,
+		      latency_percentile(bucket, total, 99) * scale,
+		      latency_percentile(bucket, total, 99.9) * scale,
+		      latency_value(max) * scale);
+	}
+}
+
+/* Log the histograms if SIGUSR1 asked for them since the last call */
+void latency_poll(void)
+{
+	if (g_latency_dump && __atomic_exchange_n(&g_latency_dump, 0, __ATOMIC_RELAXED))
+		latency_dump();
+}
+
+#endif /* !NO_LATENCY */
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
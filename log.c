@@ -0,0 +1,285 @@
+/* Logging
+ *
+ * Every thread that logs gets its own single producer, single consumer
+ * ring of fixed size records.  logit() formats the message straight into
+ * the next free record and publishes it, a writer thread collects what
+ * the rings hold and writes it to stdout in batches.  A slow reader of
+ * stdout thereby only ever fills the rings, messages that do not fit are
+ * counted and reported instead of stalling the packet loops.
+ *
+ * Before log_start() and after log_stop() messages are written directly.
+ * When reading from a file nothing is gained by dropping messages, so
+ * log_start() can have logit() wait for room instead.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "snmpbug.h"
+
+#define LOG_RECORD_SIZE		512	/* Longer messages are truncated */
+#define LOG_RING_SIZE		2048	/* Records per thread, power of 2 */
+#define LOG_NR_RINGS		(MAX_NR_WORKERS + 4)
+#define LOG_BATCH		64	/* Records per writev() */
+#define LOG_MAX_IDLE		64	/* ms the writer sleeps at most when idle */
+
+typedef struct log_record_s {
+	size_t              len;
+	char                text[LOG_RECORD_SIZE];
+} log_record_t;
+
+typedef struct log_ring_s {
+	size_t              head __attribute__((aligned(64)));	/* Written by the logging thread */
+	unsigned long       dropped;
+	size_t              tail __attribute__((aligned(64)));	/* Written by the writer thread */
+	unsigned long       reported;
+	log_record_t        record_list[LOG_RING_SIZE];
+} log_ring_t;
+
+static log_ring_t      *log_ring_list[LOG_NR_RINGS];
+static size_t           log_ring_list_length;
+static pthread_mutex_t  log_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread log_ring_t *log_ring;
+static __thread int     log_ring_failed;
+
+static pthread_t        log_thread;
+static int              log_running;
+static int              log_wait;
+static int              log_stopping;
+
+/* Format a message into buf, always newline terminated, returns its length */
+static size_t log_format(char *buf, size_t size, int syserr, const char *fmt, va_list ap)
+{
+	int len;
+
+	len = vsnprintf(buf, size - 1, fmt, ap);
+	if (len < 0)
+		len = 0;
+	else if ((size_t)len >= size - 1)
+		len = size - 2;
+
+	if (syserr > 0) {
+		len += snprintf(&buf[len], size - 1 - len, ": %s", strerror(syserr));
+		if ((size_t)len >= size - 1)
+			len = size - 2;
+	}
+
+	buf[len++] = '\n';
+
+	return len;
+}
+
+/* Write out all of iov, even if the writes come back short */
+static void log_write(struct iovec *iov, int iovcnt)
+{
+	ssize_t rv;
+
+	while (iovcnt > 0) {
+		rv = writev(STDOUT_FILENO, iov, iovcnt);
+		if (rv < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return;
+		}
+
+		while (iovcnt > 0 && (size_t)rv >= iov->iov_len) {
+			rv -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + rv;
+			iov->iov_len -= rv;
+		}
+	}
+}
+
+/* Hand the calling thread a ring of its own, once */
+static log_ring_t *log_get_ring(void)
+{
+	if (log_ring || log_ring_failed)
+		return log_ring;
+
+	pthread_mutex_lock(&log_ring_lock);
+	if (log_ring_list_length < LOG_NR_RINGS) {
+		log_ring = calloc(1, sizeof(log_ring_t));
+		if (log_ring) {
+			log_ring_list[log_ring_list_length] = log_ring;
+			__atomic_store_n(&log_ring_list_length, log_ring_list_length + 1, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&log_ring_lock);
+
+	if (!log_ring)
+		log_ring_failed = 1;
+
+	return log_ring;
+}
+
+/* Write what one ring holds, returns the number of records written */
+static size_t log_drain(log_ring_t *ring)
+{
+	struct iovec iov[LOG_BATCH + 1];
+	char buf[64];
+	unsigned long dropped;
+	size_t head, tail, n = 0;
+	int iovcnt = 0;
+
+	dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	if (dropped != ring->reported) {
+		iov[iovcnt].iov_base = buf;
+		iov[iovcnt].iov_len = snprintf(buf, sizeof(buf), "Log buffer full, dropped %lu messages\n",
+					       dropped - ring->reported);
+		iovcnt++;
+		ring->reported = dropped;
+	}
+
+	tail = ring->tail;
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	while (tail + n != head && n < LOG_BATCH) {
+		log_record_t *record = &ring->record_list[(tail + n) & (LOG_RING_SIZE - 1)];
+
+		iov[iovcnt].iov_base = record->text;
+		iov[iovcnt].iov_len = record->len;
+		iovcnt++;
+		n++;
+	}
+
+	if (iovcnt)
+		log_write(iov, iovcnt);
+	if (n)
+		__atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static void *log_writer(void UNUSED(*arg))
+{
+	struct timespec ts;
+	size_t i, n, length;
+	long idle = 1;
+
+	while (1) {
+		length = __atomic_load_n(&log_ring_list_length, __ATOMIC_ACQUIRE);
+		for (i = 0, n = 0; i < length; i++)
+			n += log_drain(log_ring_list[i]);
+
+		if (n) {
+			idle = 1;
+			continue;
+		}
+
+		/* Only stop once everything logged before log_stop() is out */
+		if (__atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE))
+			break;
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = idle * 1000000;
+		nanosleep(&ts, NULL);
+		if (idle < LOG_MAX_IDLE)
+			idle *= 2;
+	}
+
+	return NULL;
+}
+
+int log_start(int wait)
+{
+	sigset_t sigset, oldset;
+	int rc;
+
+	if (log_running)
+		return 0;
+
+	log_wait = wait;
+
+	/* Our signals are for the main thread, the writer inherits them blocked */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGHUP);
+	sigaddset(&sigset, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+	rc = pthread_create(&log_thread, NULL, log_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (rc) {
+		logit(LOG_WARNING, rc, "could not start log writer, logging synchronously");
+		return -1;
+	}
+
+	fflush(stdout);
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+	atexit(log_stop);
+
+	return 0;
+}
+
+void log_stop(void)
+{
+	if (!__atomic_exchange_n(&log_running, 0, __ATOMIC_ACQ_REL))
+		return;
+
+	__atomic_store_n(&log_stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(log_thread, NULL);
+}
+
+int logit(int priority, int syserr, const char *fmt, ...)
+{
+	char buf[LOG_RECORD_SIZE];
+	log_record_t *record;
+	log_ring_t *ring;
+	va_list ap;
+	size_t head, len;
+	struct iovec iov;
+
+	if (LOG_PRI(priority) > g_level)
+		return 0;
+
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE) || !(ring = log_get_ring())) {
+		va_start(ap, fmt);
+		len = log_format(buf, sizeof(buf), syserr, fmt, ap);
+		va_end(ap);
+
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		log_write(&iov, 1);
+
+		return len;
+	}
+
+	head = ring->head;
+	while (log_wait && head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE)
+		sched_yield();
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		STATS_INC(log_dropped);
+		return 0;
+	}
+
+	record = &ring->record_list[head & (LOG_RING_SIZE - 1)];
+	va_start(ap, fmt);
+	record->len = log_format(record->text, sizeof(record->text), syserr, fmt, ap);
+	va_end(ap);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return record->len;
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
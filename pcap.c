@@ -0,0 +1,317 @@
+/* Capture files
+ *
+ * Logs the communities of the SNMP requests in a pcap or pcapng file, as
+ * --sniff would have had they crossed an interface, each with the time it
+ * was captured.  The file is mapped rather than read and every record is
+ * parsed where it lies, so the only copy made is of the SNMP payloads.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snmpbug.h"
+
+#define PCAP_MAGIC		0xA1B2C3D4	/* Microsecond timestamps */
+#define PCAP_MAGIC_NSEC		0xA1B23C4D	/* Nanosecond timestamps */
+#define PCAP_HLEN		24
+#define PCAP_RECORD_HLEN	16
+
+#define PCAPNG_SHB		0x0A0D0D0A	/* Section header, the same in either byte order */
+#define PCAPNG_IDB		1		/* Interface description */
+#define PCAPNG_OPB		2		/* Packet, obsolete */
+#define PCAPNG_SPB		3		/* Simple packet */
+#define PCAPNG_EPB		6		/* Enhanced packet */
+#define PCAPNG_BYTE_ORDER	0x1A2B3C4D
+#define PCAPNG_OPT_TSRESOL	9
+#define PCAPNG_MAX_INTERFACES	256
+
+#define LINKTYPE_NULL		0
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_RAW_BSD	12
+#define LINKTYPE_RAW_BSD2	14
+#define LINKTYPE_RAW		101
+#define LINKTYPE_LOOP		108
+#define LINKTYPE_LINUX_SLL	113
+#define LINKTYPE_IPV4		228
+#define LINKTYPE_IPV6		229
+#define LINKTYPE_LINUX_SLL2	276
+
+typedef struct pcap_if_s {
+	int                 linktype;
+	uint64_t            units;		/* Timestamp units per second */
+} pcap_if_t;
+
+static const unsigned char *pcap_data;
+static size_t           pcap_size;
+static const char      *pcap_name;
+static int              pcap_swapped;	/* Written with the other byte order */
+static client_t         pcap_client;
+static unsigned long    pcap_packets;
+static unsigned long    pcap_requests;
+
+static pcap_if_t        pcap_if_list[PCAPNG_MAX_INTERFACES];
+static size_t           pcap_if_list_length;
+
+static uint16_t get16(const unsigned char *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return pcap_swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return pcap_swapped ? __builtin_bswap32(v) : v;
+}
+
+/* Hand one captured packet to the sniffer if it is a request to our port */
+static void pcap_packet(int linktype, const unsigned char *data, size_t len, time_t sec, long nsec)
+{
+	int rc;
+
+	pcap_packets++;
+
+	switch (linktype) {
+	case LINKTYPE_ETHERNET:
+		rc = capture_parse_frame(data, len, &pcap_client);
+		break;
+
+	case LINKTYPE_RAW:
+	case LINKTYPE_RAW_BSD:
+	case LINKTYPE_RAW_BSD2:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		rc = capture_parse_ip(data, len, &pcap_client);
+		break;
+
+	case LINKTYPE_NULL:
+	case LINKTYPE_LOOP:
+		rc = len < 4 ? -1 : capture_parse_ip(data + 4, len - 4, &pcap_client);
+		break;
+
+	case LINKTYPE_LINUX_SLL:
+		rc = len < 16 ? -1 : capture_parse_ip(data + 16, len - 16, &pcap_client);
+		break;
+
+	case LINKTYPE_LINUX_SLL2:
+		rc = len < 20 ? -1 : capture_parse_ip(data + 20, len - 20, &pcap_client);
+		break;
+
+	default:
+		rc = -1;
+		break;
+	}
+	if (rc)
+		return;
+
+	pcap_client.timestamp = sec;
+	pcap_client.timestamp_nsec = nsec;
+	if (snmp_sniff(&pcap_client) == 0)
+		pcap_requests++;
+}
+
+static void read_pcap(void)
+{
+	const unsigned char *p = pcap_data + PCAP_HLEN;
+	const unsigned char *end = pcap_data + pcap_size;
+	uint32_t magic, caplen;
+	long scale = 1000;
+	int linktype;
+
+	memcpy(&magic, pcap_data, sizeof(magic));
+	pcap_swapped = magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC;
+	if (get32(pcap_data) == PCAP_MAGIC_NSEC)
+		scale = 1;
+	linktype = get32(pcap_data + 20) & 0xFFFF;
+
+	while (!g_quit && end - p >= PCAP_RECORD_HLEN) {
+		caplen = get32(p + 8);
+		if (caplen > (size_t)(end - p) - PCAP_RECORD_HLEN) {
+			logit(LOG_WARNING, 0, "%s is truncated", pcap_name);
+			break;
+		}
+
+		pcap_packet(linktype, p + PCAP_RECORD_HLEN, caplen, get32(p), get32(p + 4) * scale);
+		p += PCAP_RECORD_HLEN + caplen;
+	}
+}
+
+/* Timestamp resolution of an interface, from its if_tsresol option */
+static uint64_t pcapng_units(const unsigned char *opt, const unsigned char *end)
+{
+	uint64_t units = 1000000;
+	uint16_t code, len;
+	int i;
+
+	while (end - opt >= 4) {
+		code = get16(opt);
+		len = get16(opt + 2);
+		if (code == 0 || (size_t)(end - opt) - 4 < len)
+			break;
+
+		if (code == PCAPNG_OPT_TSRESOL && len >= 1) {
+			if (opt[4] & 0x80) {
+				if ((opt[4] & 0x7F) < 64)
+					units = 1ULL << (opt[4] & 0x7F);
+			} else if (opt[4] <= 19) {
+				for (i = 0, units = 1; i < opt[4]; i++)
+					units *= 10;
+			}
+		}
+		opt += 4 + ((len + 3) & ~3);
+	}
+
+	return units;
+}
+
+static void read_pcapng(void)
+{
+	const unsigned char *p = pcap_data;
+	const unsigned char *end = pcap_data + pcap_size;
+	const unsigned char *body;
+	uint32_t magic, type, len, caplen, id;
+	uint64_t ts = 0, units = 1000000;
+
+	while (!g_quit && end - p >= 12) {
+		type = get32(p);
+		if (type == PCAPNG_SHB) {
+			/* Each section has its own byte order and interfaces */
+			memcpy(&magic, p + 8, sizeof(magic));
+			pcap_swapped = magic == __builtin_bswap32(PCAPNG_BYTE_ORDER);
+			if (get32(p + 8) != PCAPNG_BYTE_ORDER) {
+				logit(LOG_WARNING, 0, "%s has an invalid section header", pcap_name);
+				break;
+			}
+			pcap_if_list_length = 0;
+		}
+
+		len = get32(p + 4);
+		if (len < 12 || (len & 3) || len > (size_t)(end - p)) {
+			logit(LOG_WARNING, 0, "%s is truncated", pcap_name);
+			break;
+		}
+		body = p + 8;
+
+		switch (type) {
+		case PCAPNG_IDB:
+			if (len < 20 || pcap_if_list_length == PCAPNG_MAX_INTERFACES)
+				break;
+			pcap_if_list[pcap_if_list_length].linktype = get16(body);
+			pcap_if_list[pcap_if_list_length].units = pcapng_units(body + 8, p + len - 4);
+			pcap_if_list_length++;
+			break;
+
+		case PCAPNG_EPB:
+		case PCAPNG_OPB:
+			if (len < 32)
+				break;
+			if (type == PCAPNG_EPB)
+				id = get32(body);
+			else
+				id = get16(body);
+			caplen = get32(body + 12);
+			if (id >= pcap_if_list_length || caplen > len - 32)
+				break;
+
+			ts = (uint64_t)get32(body + 4) << 32 | get32(body + 8);
+			units = pcap_if_list[id].units;
+			pcap_packet(pcap_if_list[id].linktype, body + 20, caplen,
+				    ts / units, (double)(ts % units) * 1000000000 / units);
+			break;
+
+		case PCAPNG_SPB:
+			/* No timestamp, keep the one of the packet before */
+			if (len < 16 || !pcap_if_list_length)
+				break;
+			caplen = get32(body);
+			if (caplen > len - 16)
+				caplen = len - 16;
+			pcap_packet(pcap_if_list[0].linktype, body + 4, caplen,
+				    ts / units, (double)(ts % units) * 1000000000 / units);
+			break;
+		}
+
+		p += len;
+	}
+}
+
+int pcap_file_open(const char *file)
+{
+	struct stat st;
+	uint32_t magic;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd == -1) {
+		logit(LOG_ERR, errno, "could not open capture file %s", file);
+		exit(EXIT_SYSCALL);
+	}
+	if (fstat(fd, &st) == -1) {
+		logit(LOG_ERR, errno, "could not stat capture file %s", file);
+		exit(EXIT_SYSCALL);
+	}
+	if (st.st_size < PCAP_HLEN) {
+		logit(LOG_ERR, 0, "%s is not a pcap or pcapng file", file);
+		exit(EXIT_ARGS);
+	}
+
+	pcap_size = st.st_size;
+	pcap_data = mmap(NULL, pcap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (pcap_data == MAP_FAILED) {
+		logit(LOG_ERR, errno, "could not map capture file %s", file);
+		exit(EXIT_SYSCALL);
+	}
+	close(fd);
+
+	/* Read once from start to end, let the kernel read ahead far */
+	madvise((void *)pcap_data, pcap_size, MADV_SEQUENTIAL);
+	madvise((void *)pcap_data, pcap_size, MADV_WILLNEED);
+
+	memcpy(&magic, pcap_data, sizeof(magic));
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC &&
+	    magic != __builtin_bswap32(PCAP_MAGIC) && magic != __builtin_bswap32(PCAP_MAGIC_NSEC) &&
+	    magic != PCAPNG_SHB) {
+		logit(LOG_ERR, 0, "%s is not a pcap or pcapng file", file);
+		exit(EXIT_ARGS);
+	}
+	pcap_name = file;
+
+	return 0;
+}
+
+void run_pcap_file(void)
+{
+	uint32_t magic;
+
+	memcpy(&magic, pcap_data, sizeof(magic));
+	if (magic == PCAPNG_SHB)
+		read_pcapng();
+	else
+		read_pcap();
+	aggregate_flush(pcap_client.timestamp, 1);
+
+	logit(LOG_NOTICE, 0, "Read %lu packets, %lu requests from %s", pcap_packets, pcap_requests, pcap_name);
+
+	munmap((void *)pcap_data, pcap_size);
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -17,6 +17,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include "snmpbug.h"
 
@@ -28,8 +29,7 @@
 
 #define SNMP_VERSION_2_ERROR(resp, req, index, err) {			\
 	size_t len = (resp)->value_list_length;				\
-	memcpy(&(resp)->value_list[len].oid, &(req)->oid_list[index],	\
-	       sizeof((req)->oid_list[index]));				\
+	(resp)->value_list[len].oid = (req)->varbind_list[index].oid;	\
 	memcpy(&(resp)->value_list[len].data, &err, sizeof(err));	\
 	(resp)->value_list_length++;					\
 	continue;							\
@@ -39,7 +39,7 @@
 	if ((req)->version == SNMP_VERSION_1)				\
 		SNMP_VERSION_1_ERROR((resp), (code), (index));		\
 									\
-	if ((resp)->value_list_length < MAX_NR_VALUES)			\
+	if ((resp)->value_list_length < (resp)->value_list_size)	\
 		SNMP_VERSION_2_ERROR((resp), (req), (index), err); 	\
 									\
 	logit(LOG_ERR, 0, "%s", msg);					\
@@ -50,82 +50,104 @@ static const data_t m_null              = { (unsigned char *)"\x05\x00", 2, 2 };
 static const data_t m_no_such_object    = { (unsigned char *)"\x80\x00", 2, 2 };
 static const data_t m_end_of_mib_view   = { (unsigned char *)"\x82\x00", 2, 2 };
 
+#define HEXDUMP_LINE	128	/* Packet bytes per debug line */
+static __thread char m_hexdump[HEXDUMP_LINE * 3];
+
+/* Arrival time of the last timestamped request, from the kernel or a capture file, formatted once a second */
+static __thread time_t m_capture_time = -1;
+static __thread char m_capture_date[32];
+
+/* Response values, reused by every request handled on this thread */
+static __thread value_t m_value_list[MAX_NR_VARBINDS];
+
+/* For the full encoder, which decodes the OIDs only when it needs them */
+static __thread unsigned char m_request[MAX_PACKET_SIZE];
+static __thread oid_t m_oid;
+
+
+/* The ASN.1 element types we accept (only subset of universal tags supported) */
+static const unsigned char m_ber_types[256] = {
+	[BER_TYPE_BOOLEAN]           = 1,
+	[BER_TYPE_INTEGER]           = 1,
+	[BER_TYPE_BIT_STRING]        = 1,
+	[BER_TYPE_OCTET_STRING]      = 1,
+	[BER_TYPE_NULL]              = 1,
+	[BER_TYPE_OID]               = 1,
+	[BER_TYPE_SEQUENCE]          = 1,
+	[BER_TYPE_COUNTER]           = 1,
+	[BER_TYPE_GAUGE]             = 1,
+	[BER_TYPE_TIME_TICKS]        = 1,
+	[BER_TYPE_NO_SUCH_OBJECT]    = 1,
+	[BER_TYPE_NO_SUCH_INSTANCE]  = 1,
+	[BER_TYPE_END_OF_MIB_VIEW]   = 1,
+	[BER_TYPE_SNMP_GET]          = 1,
+	[BER_TYPE_SNMP_GETNEXT]      = 1,
+	[BER_TYPE_SNMP_RESPONSE]     = 1,
+	[BER_TYPE_SNMP_SET]          = 1,
+	[BER_TYPE_SNMP_GETBULK]      = 1,
+	[BER_TYPE_SNMP_INFORM]       = 1,
+	[BER_TYPE_SNMP_TRAP]         = 1,
+};
 
 static int decode_len(const unsigned char *packet, size_t size, size_t *pos, int *type, size_t *len)
 {
-	size_t length_of_len;
+	const unsigned char *p = &packet[*pos];
+	size_t avail;
 
 	if (*pos >= size) {
 		logit(LOG_DEBUG, 0, "underflow for element type");
 		errno = EINVAL;
 		return -1;
 	}
+	avail = size - *pos;
 
-	/* Fetch the ASN.1 element type (only subset of universal tags supported) */
-	switch (packet[*pos]) {
-	case BER_TYPE_BOOLEAN:
-	case BER_TYPE_INTEGER:
-	case BER_TYPE_BIT_STRING:
-	case BER_TYPE_OCTET_STRING:
-	case BER_TYPE_NULL:
-	case BER_TYPE_OID:
-	case BER_TYPE_SEQUENCE:
-	case BER_TYPE_COUNTER:
-	case BER_TYPE_GAUGE:
-	case BER_TYPE_TIME_TICKS:
-	case BER_TYPE_NO_SUCH_OBJECT:
-	case BER_TYPE_NO_SUCH_INSTANCE:
-	case BER_TYPE_END_OF_MIB_VIEW:
-	case BER_TYPE_SNMP_GET:
-	case BER_TYPE_SNMP_GETNEXT:
-	case BER_TYPE_SNMP_RESPONSE:
-	case BER_TYPE_SNMP_SET:
-	case BER_TYPE_SNMP_GETBULK:
-	case BER_TYPE_SNMP_INFORM:
-	case BER_TYPE_SNMP_TRAP:
-		*type = packet[*pos];
-		*pos = *pos + 1;
-		break;
-
-	default:
-		logit(LOG_DEBUG, 0, "unsupported element type %02X", packet[*pos]);
-		errno = EINVAL;
-		return -1;
-	}
-
-	if (*pos >= size) {
-		logit(LOG_DEBUG, 0, "underflow for element length");
+	/* Fetch the ASN.1 element type */
+	if (!m_ber_types[p[0]]) {
+		logit(LOG_DEBUG, 0, "unsupported element type %02X", p[0]);
 		errno = EINVAL;
 		return -1;
 	}
+	*type = p[0];
 
 	/* Fetch the ASN.1 element length (only lengths up to 16 bit supported) */
-	if (!(packet[*pos] & 0x80)) {
-		*len = packet[*pos];
-		*pos = *pos + 1;
-	} else {
-		length_of_len = packet[*pos] & 0x7F;
-		if (length_of_len > 2) {
-			logit(LOG_DEBUG, 0, "overflow for element length");
-			errno = EINVAL;
-			return -1;
-		}
+	if (avail < 2)
+		goto underflow;
 
-		*pos = *pos + 1;
+	if (p[1] < 0x80) {
+		*len = p[1];
+		*pos = *pos + 2;
+		return 0;
+	}
+
+	switch (p[1]) {
+	case 0x80:
 		*len = 0;
-		while (length_of_len--) {
-			if (*pos >= size) {
-				logit(LOG_DEBUG, 0, "underflow for element length");
-				errno = EINVAL;
-				return -1;
-			}
+		*pos = *pos + 2;
+		return 0;
 
-			*len = (*len << 8) + packet[*pos];
-			*pos = *pos + 1;
-		}
+	case 0x81:
+		if (avail < 3)
+			goto underflow;
+		*len = p[2];
+		*pos = *pos + 3;
+		return 0;
+
+	case 0x82:
+		if (avail < 4)
+			goto underflow;
+		*len = (p[2] << 8) | p[3];
+		*pos = *pos + 4;
+		return 0;
 	}
 
-	return 0;
+	logit(LOG_DEBUG, 0, "overflow for element length");
+	errno = EINVAL;
+	return -1;
+
+underflow:
+	logit(LOG_DEBUG, 0, "underflow for element length");
+	errno = EINVAL;
+	return -1;
 }
 
 /* Fetch the value as unsigned integer (copy sign bit into all bytes first) */
@@ -170,7 +192,7 @@ static int decode_cnt(const unsigned char *packet, size_t size, size_t *pos, siz
 /* Fetch the value as C string (user must have made sure the length is ok) */
 static int decode_str(const unsigned char *packet, size_t size, size_t *pos, size_t len, char *str, size_t str_len)
 {
-	if (*pos >= (size - len + 1)) {
+	if (len > size - *pos) {
 		logit(LOG_DEBUG, 0, "underflow for string");
 		errno = EINVAL;
 		return -1;
@@ -185,7 +207,7 @@ static int decode_str(const unsigned char *packet, size_t size, size_t *pos, siz
 /* Fetch the value as C string (user must have made sure the length is ok) */
 static int decode_oid(const unsigned char *packet, size_t size, size_t *pos, size_t len, oid_t *value)
 {
-	if (*pos >= (size - len + 1)) {
+	if (len > size - *pos) {
 		logit(LOG_DEBUG, 0, "underflow for oid");
 		errno = EINVAL;
 		return -1;
@@ -251,10 +273,37 @@ static int decode_oid(const unsigned char *packet, size_t size, size_t *pos, siz
 	return 0;
 }
 
+/* Check an OID without decoding it, the subids are decoded by decode_oid() on demand */
+static int check_oid(const unsigned char *packet, size_t size, size_t *pos, size_t len)
+{
+	if (len > size - *pos) {
+		logit(LOG_DEBUG, 0, "underflow for oid");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (packet[*pos] & 0x80) {
+		logit(LOG_DEBUG, 0, "unsupported OID startbyte %02X", packet[*pos]);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* The last subid must end with the OID */
+	if (packet[*pos + len - 1] & 0x80) {
+		logit(LOG_DEBUG, 0, "underflow for OID byte");
+		errno = EINVAL;
+		return -1;
+	}
+
+	*pos = *pos + len;
+
+	return 0;
+}
+
 /* Fetch the value as pointer (user must make sure not to overwrite packet) */
 static int decode_ptr(const unsigned char UNUSED(*packet), size_t size, size_t *pos, int len)
 {
-	if (*pos >= (size - len + 1)) {
+	if ((size_t)len > size - *pos) {
 		logit(LOG_DEBUG, 0, "underflow for ptr");
 		errno = EINVAL;
 		return -1;
@@ -265,8 +314,9 @@ static int decode_ptr(const unsigned char UNUSED(*packet), size_t size, size_t *
 	return 0;
 }
 
-static int decode_snmp_request(request_t *request, client_t *client)
+static int decode_snmp_request(request_t *request, const client_t *client)
 {
+	varbind_t *varbind;
 	int type;
 	size_t pos = 0, len = 0;
 	const char *header_msg  = "Unexpected SNMP header";
@@ -275,166 +325,209 @@ static int decode_snmp_request(request_t *request, client_t *client)
 	const char *varbind_msg = "Unexpected SNMP varbindings";
 	const char *commun_msg  = "SNMP community";
 	const char *version_msg = "SNMP version";
+	int stage = STATS_DECODE_HEADER;
 
 	/* The SNMP message is enclosed in a sequence */
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (type != BER_TYPE_SEQUENCE || len != (client->size - pos)) {
 		logit(LOG_DEBUG, 0, "%s type %02X length %zu", header_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	/* The first element of the sequence is the version */
+	stage = STATS_DECODE_VERSION;
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (type != BER_TYPE_INTEGER || len != 1) {
 		logit(LOG_DEBUG, 0, "Unexpected %s type %02X length %zu", version_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	if (decode_int(client->packet, client->size, &pos, len, &request->version) == -1)
-		return -1;
+		goto fail;
 
 	if (request->version != SNMP_VERSION_1 && request->version != SNMP_VERSION_2C) {
 		logit(LOG_DEBUG, 0, "Unsupported %s %d", version_msg, request->version);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	/* The second element of the sequence is the community string */
+	stage = STATS_DECODE_COMMUNITY;
+	request->community_view.pos = pos;
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (type != BER_TYPE_OCTET_STRING || len >= sizeof(request->community)) {
 		logit(LOG_DEBUG, 0, "Unexpected %s type %02X length %zu", commun_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	if (decode_str(client->packet, client->size, &pos, len, request->community, sizeof(request->community)) == -1)
-		return -1;
+		goto fail;
+	request->community_view.len = pos - request->community_view.pos;
 
 	if (strlen(request->community) < 1) {
 		logit(LOG_DEBUG, 0, "empty/unsupported %s '%s'", commun_msg, request->community);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	/* The third element of the sequence is the SNMP request */
+	stage = STATS_DECODE_PDU;
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (len != (client->size - pos)) {
 		logit(LOG_DEBUG, 0, "%s type type %02X length %zu", request_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 	request->type = type;
 
 	/* The first element of the SNMP request is the request ID */
+	request->id_view.pos = pos;
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (type != BER_TYPE_INTEGER || len < 1) {
 		logit(LOG_DEBUG, 0, "%s id type %02X length %zu", request_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	if (decode_int(client->packet, client->size, &pos, len, &request->id) == -1)
-		return -1;
+		goto fail;
+	request->id_view.len = pos - request->id_view.pos;
 
 	/* The second element of the SNMP request is the error state / non repeaters (0..2147483647) */
+	request->error_view[0].pos = pos;
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (type != BER_TYPE_INTEGER || len < 1) {
 		logit(LOG_DEBUG, 0, "%s state type %02X length %zu", error_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	if (decode_cnt(client->packet, client->size, &pos, len, &request->non_repeaters) == -1)
-		return -1;
+		goto fail;
+	request->error_view[0].len = pos - request->error_view[0].pos;
 
 	/* The third element of the SNMP request is the error index / max repetitions (0..2147483647) */
+	request->error_view[1].pos = pos;
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (type != BER_TYPE_INTEGER || len < 1) {
 		logit(LOG_DEBUG, 0, "%s index type %02X length %zu", error_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	if (decode_cnt(client->packet, client->size, &pos, len, &request->max_repetitions) == -1)
-		return -1;
+		goto fail;
+	request->error_view[1].len = pos - request->error_view[1].pos;
 
 	/* The fourth element of the SNMP request are the variable bindings */
+	stage = STATS_DECODE_VARBINDS;
 	if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-		return -1;
+		goto fail;
 
 	if (type != BER_TYPE_SEQUENCE || len != (client->size - pos)) {
 		logit(LOG_DEBUG, 0, "%s type %02X length %zu", varbind_msg, type, len);
 		errno = EINVAL;
-		return -1;
+		goto fail;
 	}
 
 	/* Loop through the variable bindings */
-	request->oid_list_length = 0;
+	request->varbind_list_length = 0;
 	while (pos < client->size) {
-		/* If there is not enough room in the OID list, bail out now */
-		if (request->oid_list_length >= MAX_NR_OIDS) {
+		/* If there is not enough room in the varbind list, bail out now */
+		if (request->varbind_list_length >= MAX_NR_VARBINDS) {
 			logit(LOG_DEBUG, 0, "Overflow in OID list");
 			errno = EFAULT;
-			return -1;
+			goto fail;
 		}
 
 		/* Each variable binding is a sequence describing the variable */
+		varbind = &request->varbind_list[request->varbind_list_length];
+		varbind->varbind.pos = pos;
 		if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-			return -1;
+			goto fail;
 
 		if (type != BER_TYPE_SEQUENCE || len < 1) {
 			logit(LOG_DEBUG, 0, "%s type %02X length %zu", varbind_msg, type, len);
 			errno = EINVAL;
-			return -1;
+			goto fail;
 		}
+		varbind->varbind.len = pos - varbind->varbind.pos + len;
 
 		/* The first element of the variable binding is the OID */
+		varbind->oid.pos = pos;
 		if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-			return -1;
+			goto fail;
 
 		if (type != BER_TYPE_OID || len < 1) {
 			logit(LOG_DEBUG, 0, "%s OID type %02X length %zu", varbind_msg, type, len);
 			errno = EINVAL;
-			return -1;
+			goto fail;
 		}
 
-		if (decode_oid(client->packet, client->size, &pos, len, &request->oid_list[request->oid_list_length]) == -1)
-			return -1;
+		if (check_oid(client->packet, client->size, &pos, len) == -1)
+			goto fail;
+		varbind->oid.len = pos - varbind->oid.pos;
 
 		/* The second element of the variable binding is the new type and value */
+		varbind->value.pos = pos;
 		if (decode_len(client->packet, client->size, &pos, &type, &len) == -1)
-			return -1;
+			goto fail;
 
 		if ((type == BER_TYPE_NULL && len) || (type != BER_TYPE_NULL && !len)) {
 			logit(LOG_DEBUG, 0, "%s value type %02X length %zu", varbind_msg, type, len);
 			errno = EINVAL;
-			return -1;
+			goto fail;
 		}
 
 		if (decode_ptr(client->packet, client->size, &pos, len) == -1)
-			return -1;
+			goto fail;
+		varbind->value.len = pos - varbind->value.pos;
 
 		/* Now the OID list has one more entry */
-		request->oid_list_length++;
+		request->varbind_list_length++;
+	}
+
+	STATS_INC(versions[request->version == SNMP_VERSION_2C]);
+	switch (request->type) {
+	case BER_TYPE_SNMP_GET:
+		STATS_INC(requests[STATS_TYPE_GET]);
+		break;
+	case BER_TYPE_SNMP_GETNEXT:
+		STATS_INC(requests[STATS_TYPE_GETNEXT]);
+		break;
+	case BER_TYPE_SNMP_GETBULK:
+		STATS_INC(requests[STATS_TYPE_GETBULK]);
+		break;
+	case BER_TYPE_SNMP_SET:
+		STATS_INC(requests[STATS_TYPE_SET]);
+		break;
+	default:
+		STATS_INC(requests[STATS_TYPE_OTHER]);
+		break;
 	}
 
 	return 0;
+
+fail:
+	STATS_INC(decode_errors[stage]);
+	return -1;
 }
 
 
@@ -605,9 +698,17 @@ static int log_encoding_error(const char *what, const char *why)
 	return -1;
 }
 
-static int encode_snmp_varbind(unsigned char *buf, size_t *pos, const value_t *value)
+static int encode_snmp_varbind(unsigned char *buf, size_t *pos, const value_t *value,
+			       const unsigned char *request, size_t size)
 {
-	size_t len;
+	size_t len, oid_pos;
+	int type;
+
+	/* Decode the OID of the request, it's been checked already */
+	oid_pos = value->oid.pos;
+	if (decode_len(request, size, &oid_pos, &type, &len) == -1 ||
+	    decode_oid(request, size, &oid_pos, len, &m_oid) == -1)
+		return log_encoding_error("data", "OID invalid");
 
 	/* The value of the variable binding (NULL for error responses) */
 	len = value->data.encoded_length;
@@ -618,24 +719,165 @@ static int encode_snmp_varbind(unsigned char *buf, size_t *pos, const value_t *v
 	*pos = *pos - len;
 
 	/* The OID of the variable binding */
-	len = value->oid.encoded_length;
+	len = m_oid.encoded_length;
 	if (*pos < len)
 		return log_encoding_error("data", "OID overflow");
 
-	encode_snmp_oid(&buf[*pos - len], &value->oid);
+	encode_snmp_oid(&buf[*pos - len], &m_oid);
 	*pos = *pos - len;
 
 	/* The sequence header (type and length) of the variable binding */
-	len = get_hdrlen(value->oid.encoded_length + value->data.encoded_length);
+	len = get_hdrlen(m_oid.encoded_length + value->data.encoded_length);
 	if (*pos < len)
 		return log_encoding_error("data", "VARBIND overflow");
 
-	encode_snmp_sequence_header(&buf[*pos - len], value->oid.encoded_length + value->data.encoded_length, BER_TYPE_SEQUENCE);
+	encode_snmp_sequence_header(&buf[*pos - len], m_oid.encoded_length + value->data.encoded_length, BER_TYPE_SEQUENCE);
 	*pos = *pos - len;
 
 	return 0;
 }
 
+/* Whether any of the bytes has the high bit set, checked eight at a time */
+static int has_high_bit(const unsigned char *buf, size_t len)
+{
+	uint64_t word, bits = 0;
+
+	while (len >= sizeof(word)) {
+		memcpy(&word, buf, sizeof(word));
+		bits |= word;
+		buf += sizeof(word);
+		len -= sizeof(word);
+	}
+	while (len--)
+		bits |= *buf++;
+
+	return (bits & 0x8080808080808080ULL) != 0;
+}
+
+/* Length of the type and length header of the BER element in view */
+static size_t view_hdrlen(const unsigned char *packet, const view_t *view)
+{
+	if (packet[view->pos + 1] & 0x80)
+		return 2 + (packet[view->pos + 1] & 0x7F);
+
+	return 2;
+}
+
+/*
+ * Fast path for encode_snmp_response(): our responses repeat the request
+ * with another PDU type, new error fields and new values, so the request
+ * is rewritten in place instead of encoded from scratch.  This is only
+ * done when the request bytes we keep are encoded exactly the way the
+ * full encoder would encode them, i.e. minimal lengths and integers, no
+ * NUL in the community and OIDs that survive decoding unchanged, so the
+ * result is always byte-identical.  Everything we write is at most as
+ * long as what it replaces, so the rewrite can move forward in place.
+ *
+ * Returns 1 when the caller has to use the full encoder instead.
+ */
+static int rewrite_snmp_response(const request_t *request, const response_t *response, client_t *client)
+{
+	unsigned char *packet = client->packet;
+	const varbind_t *varbind;
+	const data_t *data;
+	view_t message = { 0, client->size };
+	size_t i, j, n, hdr, len, out;
+	size_t vbl_len = 0, pdu_len, msg_len;
+
+	if (response->error_status != SNMP_STATUS_OK) {
+		if (get_intlen(response->error_status) != 3 || get_intlen(response->error_index) != 3)
+			return 1;
+	} else if (response->value_list_length != request->varbind_list_length) {
+		return 1;
+	}
+
+	/* The version, community and request ID are kept as they are */
+	if (request->community_view.pos != view_hdrlen(packet, &message) + 3)
+		return 1;
+	if (view_hdrlen(packet, &request->community_view) != 2 ||
+	    memchr(&packet[request->community_view.pos + 2], 0, request->community_view.len - 2))
+		return 1;
+	if (view_hdrlen(packet, &request->id_view) != 2 || get_intlen(request->id) != request->id_view.len)
+		return 1;
+
+	/* The error status and index must keep their size */
+	if (request->error_view[0].len != 3 || request->error_view[1].len != 3)
+		return 1;
+
+	for (i = 0; i < request->varbind_list_length; i++) {
+		varbind = &request->varbind_list[i];
+
+		/* Subids without leading zero bytes, that fit in 32 bits */
+		hdr = view_hdrlen(packet, &varbind->oid);
+		if (hdr != get_hdrlen(varbind->oid.len - hdr))
+			return 1;
+		j = varbind->oid.pos + hdr + 1;
+		if (!has_high_bit(&packet[j], varbind->oid.pos + varbind->oid.len - j))
+			j = varbind->oid.pos + varbind->oid.len;	/* Only single byte subids */
+		for (n = 0; j < varbind->oid.pos + varbind->oid.len; j++) {
+			if (!n && packet[j] == 0x80)
+				return 1;
+			if (++n == 5 && packet[j - 4] > 0x8F)
+				return 1;
+			if (n > 5)
+				return 1;
+			if (!(packet[j] & 0x80))
+				n = 0;
+		}
+
+		/* The varbind sequence header must be minimal and agree with its content */
+		len = varbind->oid.len + varbind->value.len;
+		if (varbind->varbind.len != varbind->oid.pos - varbind->varbind.pos + len ||
+		    varbind->oid.pos - varbind->varbind.pos != get_hdrlen(len))
+			return 1;
+
+		data = response->error_status != SNMP_STATUS_OK ? &m_null : &response->value_list[i].data;
+		if ((size_t)data->encoded_length > varbind->value.len)
+			return 1;
+
+		len = varbind->oid.len + data->encoded_length;
+		vbl_len += get_hdrlen(len) + len;
+	}
+
+	pdu_len = request->id_view.len + 3 + 3 + get_hdrlen(vbl_len) + vbl_len;
+	msg_len = 3 + request->community_view.len + get_hdrlen(pdu_len) + pdu_len;
+	if (get_hdrlen(msg_len) + msg_len > MAX_PACKET_SIZE)
+		return 1;
+
+	/* Now rewrite, the output never overtakes the request bytes still to be read */
+	out = 0;
+	encode_snmp_sequence_header(&packet[out], msg_len, BER_TYPE_SEQUENCE);
+	out += get_hdrlen(msg_len);
+	memmove(&packet[out], &packet[request->community_view.pos - 3], 3 + request->community_view.len);
+	out += 3 + request->community_view.len;
+	encode_snmp_sequence_header(&packet[out], pdu_len, BER_TYPE_SNMP_RESPONSE);
+	out += get_hdrlen(pdu_len);
+	memmove(&packet[out], &packet[request->id_view.pos], request->id_view.len);
+	out += request->id_view.len;
+	encode_snmp_integer(&packet[out], response->error_status);
+	out += 3;
+	encode_snmp_integer(&packet[out], response->error_index);
+	out += 3;
+	encode_snmp_sequence_header(&packet[out], vbl_len, BER_TYPE_SEQUENCE);
+	out += get_hdrlen(vbl_len);
+
+	for (i = 0; i < request->varbind_list_length; i++) {
+		varbind = &request->varbind_list[i];
+		data = response->error_status != SNMP_STATUS_OK ? &m_null : &response->value_list[i].data;
+
+		len = varbind->oid.len + data->encoded_length;
+		encode_snmp_sequence_header(&packet[out], len, BER_TYPE_SEQUENCE);
+		out += get_hdrlen(len);
+		memmove(&packet[out], &packet[varbind->oid.pos], varbind->oid.len);
+		out += varbind->oid.len;
+		memcpy(&packet[out], data->buffer, data->encoded_length);
+		out += data->encoded_length;
+	}
+	client->size = out;
+
+	return 0;
+}
+
 static int encode_snmp_response(request_t *request, response_t *response, client_t *client)
 {
 	size_t i, len, pos;
@@ -644,14 +886,14 @@ static int encode_snmp_response(request_t *request, response_t *response, client
 	 * omit any varbind values (replace them with NULL values)
 	 */
 	if (response->error_status != SNMP_STATUS_OK) {
-		if (request->oid_list_length > MAX_NR_VALUES)
+		if (request->varbind_list_length > response->value_list_size)
 			return log_encoding_error("SNMP response", "value list overflow");
 
-		for (i = 0; i < request->oid_list_length && i < NELEMS(request->oid_list); i++) {
-			memcpy(&response->value_list[i].oid, &request->oid_list[i], sizeof(request->oid_list[i]));
+		for (i = 0; i < request->varbind_list_length; i++) {
+			response->value_list[i].oid = request->varbind_list[i].oid;
 			memcpy(&response->value_list[i].data, &m_null, sizeof(m_null));
 		}
-		response->value_list_length = request->oid_list_length;
+		response->value_list_length = request->varbind_list_length;
 	}
 
 	/* To make the code more compact and save processing time, we are encoding the
@@ -659,9 +901,11 @@ static int encode_snmp_response(request_t *request, response_t *response, client
 	 * packet will not be positioned at offset 0..(size-1) of the client's packet
 	 * buffer, but at offset (bufsize-size..bufsize-1)!
 	 */
+	/* The OIDs are read from a copy, the request gets overwritten from the end */
+	memcpy(m_request, client->packet, client->size);
 	pos = MAX_PACKET_SIZE;
 	for (i = response->value_list_length; i > 0; i--) {
-		if (encode_snmp_varbind(client->packet, &pos, &response->value_list[i-1]) == -1)
+		if (encode_snmp_varbind(client->packet, &pos, &response->value_list[i-1], m_request, client->size) == -1)
 			return -1;
 	}
 
@@ -743,7 +987,7 @@ static int handle_snmp_get(request_t *request, response_t *response, client_t *U
 	 * response. Note that if the length does not match, we might have found a
 	 * subid of the requested one (table cell of table column)!
 	 */
-	for (i = 0; i < request->oid_list_length; i++) {
+	for (i = 0; i < request->varbind_list_length; i++) {
 		SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_no_such_object, msg);
 		logit(LOG_ERR, 0, "%s", msg);
 		return -1;
@@ -762,7 +1006,7 @@ static int handle_snmp_getnext(request_t *request, response_t *response, client_
 	 * response. Note that if the length does not match, we might have found a
 	 * subid of the requested one (table cell of table column)!
 	 */
-	for (i = 0; i < request->oid_list_length; i++) {
+	for (i = 0; i < request->varbind_list_length; i++) {
 		SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_end_of_mib_view, msg);
 
 		logit(LOG_ERR, 0, "%s", msg);
@@ -784,7 +1028,7 @@ static int handle_snmp_getbulk(request_t *request, response_t *response, client_
 	const char *msg = "Failed handling SNMP GETBULK: value list overflow\n";
 
 	/* The non-repeaters are handled like with the GETNEXT request */
-	for (i = 0; i < request->oid_list_length; i++) {
+	for (i = 0; i < request->varbind_list_length; i++) {
 		if (i >= request->non_repeaters)
 			break;
 
@@ -804,7 +1048,7 @@ static int handle_snmp_getbulk(request_t *request, response_t *response, client_
 	 * - other than with getnext, the last variable in the MIB is named if
 	 *   the variable queried is not after the end of the MIB
 	 */
-	for (i = request->non_repeaters; i < request->oid_list_length; i++) {
+	for (i = request->non_repeaters; i < request->varbind_list_length; i++) {
 		SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_end_of_mib_view, msg);
 
 		logit(LOG_ERR, 0, "%s", msg);
@@ -842,50 +1086,118 @@ int snmp_packet_complete(const client_t *client)
 	return ((client->size - pos) == len) ? 1 : 0;
 }
 
-int snmp(client_t *client)
+static void format_addr(const my_in_addr_t *addr, char *straddr, size_t len)
+{
+	size_t i;
+
+	inet_ntop(my_af_inet, addr, straddr, len);
+	if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
+		for(i=0; i < (strlen(straddr) - 7); i++) {
+			straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
+		}
+		straddr[i]='\0';  /* set the new termination point */
+	}
+}
+
+static void log_community(const request_t *request, const client_t *client)
+{
+	size_t i, len;
+	char straddr[my_inet_addrstrlen];
+	char strlocal[my_inet_addrstrlen + 4] = "";
+	int first;
+
+	/* Repeats are only counted, for the next summary */
+	first = aggregate_request(request, client);
+	if (!first && g_level < LOG_DEBUG)
+		return;
+
+	format_addr(&client->addr, straddr, sizeof(straddr));
+
+	/* Which of our addresses it was sent to, when we know */
+	if (!IN6_IS_ADDR_UNSPECIFIED(&client->local_addr)) {
+		memcpy(strlocal, " to ", 4);
+		format_addr(&client->local_addr, strlocal + 4, sizeof(strlocal) - 4);
+	}
+
+	if (first && client->timestamp_nsec >= 0) {
+		if (client->timestamp != m_capture_time) {
+			struct tm tm;
+
+			gmtime_r(&client->timestamp, &tm);
+			strftime(m_capture_date, sizeof(m_capture_date), "%Y-%m-%dT%H:%M:%S", &tm);
+			m_capture_time = client->timestamp;
+		}
+		logit(LOG_INFO, 0, "%s.%06ldZ host %s%s used community: '%s'", m_capture_date,
+		      client->timestamp_nsec / 1000, straddr, strlocal, request->community);
+	} else if (first) {
+		logit(LOG_INFO, 0, "host %s%s used community: '%s'", straddr, strlocal, request->community);
+	}
+
+	/* The whole packet only when debugging, a line per HEXDUMP_LINE bytes */
+	if (g_level < LOG_DEBUG)
+		return;
+
+	for (i = 0; i < client->size; i += len) {
+		len = client->size - i;
+		if (len > HEXDUMP_LINE)
+			len = HEXDUMP_LINE;
+
+		hexdump(m_hexdump, sizeof(m_hexdump), &client->packet[i], len);
+		logit(LOG_DEBUG, 0, "host %s packet %04zX: %s", straddr, i, m_hexdump);
+	}
+}
+
+/* Decode and log a request seen passively, no response is prepared */
+int snmp_sniff(const client_t *client)
 {
-	response_t response;
 	request_t request;
+	uint64_t stamp;
+	int rc;
+
+	LATENCY_SAMPLE_STAMP(stamp);
+	rc = decode_snmp_request(&request, client);
+	LATENCY_PHASE(LATENCY_DECODE, stamp);
+	if (rc == -1)
+		return -1;
 
-	/* Setup request and response (other code only changes non-defaults) */
-	memset(&request, 0, sizeof(request));
-	memset(&response, 0, sizeof(response));
+	log_community(&request, client);
+	LATENCY_PHASE(LATENCY_LOG, stamp);
 
-	/* Decode the request (only checks for syntax of the packet) */
-	if (decode_snmp_request(&request, client) == -1)
+	return 0;
+}
+
+int snmp(client_t *client)
+{
+	response_t response;
+	request_t request;
+	uint64_t stamp;
+	int rc;
+
+	/* Decode the request (only checks for syntax of the packet, sets all fields) */
+	LATENCY_SAMPLE_STAMP(stamp);
+	rc = decode_snmp_request(&request, client);
+	LATENCY_PHASE(LATENCY_DECODE, stamp);
+	if (rc == -1)
 		return -1;
 
+	/*
+	 * Setup the response, the handlers add at most one value per varbind
+	 * and always write all of it, so only the header needs initializing.
+	 */
+	response.error_status = SNMP_STATUS_OK;
+	response.error_index = 0;
+	response.value_list = m_value_list;
+	response.value_list_size = request.varbind_list_length;
+	response.value_list_length = 0;
+
 	/*
 	 * check the community string for length and validity.
 	 */
 
 
 	if (request.version == SNMP_VERSION_2C || request.version == SNMP_VERSION_1) {
-		char *buf = allocate(BUFSIZ);
-		if (buf) {
-			size_t i, len = 0;
-			char straddr[my_inet_addrstrlen];
-			my_in_addr_t client_addr;
-
-			client_addr = client->addr;
-			for (i = 0; i < client->size; i++) {
-				len += snprintf(buf + len, BUFSIZ - len, i ? " %02X" : "%02X", client->packet[i]);
-				if (len >= BUFSIZ)
-					break;
-			}
-			inet_ntop(my_af_inet, &client_addr, straddr, sizeof(straddr));
-			if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
-				for(i=0; i < (strlen(straddr) - 7); i++) {
-					straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
-				}
-				straddr[i]='\0';  /* set the new termination point */
-			}
-			logit(LOG_INFO, 0, "host %s used community: '%s'", straddr, request.community);
-			free(buf);
-		} else {
-			logit(LOG_INFO, 0, "remote used community: '%s'", request.community);
-		}
-
+		log_community(&request, client);
+		LATENCY_PHASE(LATENCY_LOG, stamp);
 	} else if (g_auth) {
 		response.error_status = SNMP_STATUS_GEN_ERR;
 		response.error_index = 0;
@@ -920,10 +1232,15 @@ int snmp(client_t *client)
 		client->size = 0;
 		return 0;
 	}
+	LATENCY_PHASE(LATENCY_HANDLE, stamp);
 
 done:
 	/* Encode the request (depending on error status and encode flags) */
-	if (encode_snmp_response(&request, &response, client) == -1)
+	rc = rewrite_snmp_response(&request, &response, client);
+	if (rc == 1)
+		rc = encode_snmp_response(&request, &response, client);
+	LATENCY_PHASE(LATENCY_ENCODE, stamp);
+	if (rc == -1)
 		return -1;
 
 	return 0;
@@ -0,0 +1,133 @@
+/* Per source rate limiting
+ *
+ * Checked for every UDP datagram before any of it is decoded, so a single
+ * noisy source can not have every one of its requests answered.  Each
+ * source address gets a token bucket holding up to g_rate_burst requests
+ * and refilled with g_rate_limit requests per second; what finds its
+ * bucket empty is dropped without a word.
+ *
+ * Every worker thread has a fixed table of RATELIMIT_NR_BUCKETS buckets,
+ * four to a cache line, which a source address hashes into.  A source
+ * without a bucket takes the one in its line that was not used since the
+ * CLOCK hand last went past it, so any number of (spoofed) sources only
+ * ever recycle buckets and memory use does not grow.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "snmpbug.h"
+
+#define RATELIMIT_NR_BUCKETS	65536	/* Per worker, power of 2 */
+#define RATELIMIT_WAYS		4	/* Buckets per cache line */
+
+#define RATELIMIT_USED		1	/* Key bits, looked up since the hand passed */
+#define RATELIMIT_VALID		2
+#define RATELIMIT_FLAGS		(RATELIMIT_USED | RATELIMIT_VALID)
+
+typedef struct bucket_s {
+	uint64_t            key;		/* Hash of the source and flags */
+	uint32_t            stamp;		/* ms of the last refill */
+	uint32_t            tokens;		/* In thousandths of a request */
+} bucket_t;
+
+static __thread bucket_t *ratelimit_table;
+static __thread int     ratelimit_failed;
+static __thread unsigned ratelimit_hand;
+static __thread uint64_t ratelimit_seed;
+
+/* Milliseconds, the coarse clock is plenty and costs next to nothing */
+uint32_t ratelimit_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint32_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bucket_t *ratelimit_get_table(void)
+{
+	if (ratelimit_table || ratelimit_failed)
+		return ratelimit_table;
+
+	/* Keyed per run and thread, so nobody can aim their sources at one line */
+	ratelimit_seed = ((uint64_t)time(NULL) << 20) ^ getpid() ^ (uintptr_t)&ratelimit_table;
+
+	if (posix_memalign((void **)&ratelimit_table, 64, RATELIMIT_NR_BUCKETS * sizeof(bucket_t))) {
+		logit(LOG_WARNING, ENOMEM, "could not allocate rate limiter, not limiting");
+		ratelimit_table = NULL;
+		ratelimit_failed = 1;
+		return NULL;
+	}
+	memset(ratelimit_table, 0, RATELIMIT_NR_BUCKETS * sizeof(bucket_t));
+
+	return ratelimit_table;
+}
+
+/* Take a token from the bucket of a source, -1 when it has none left */
+int ratelimit(const my_in_addr_t *addr, uint32_t now)
+{
+	const uint64_t k = 0x9E3779B97F4A7C15ULL;
+	uint64_t w[2], h, key, refill;
+	bucket_t *line, *bucket;
+	uint32_t burst = g_rate_burst * 1000;
+	unsigned i;
+
+	if (!ratelimit_get_table())
+		return 0;
+
+	memcpy(w, addr, sizeof(w));
+	h = (w[0] ^ ratelimit_seed) * k;
+	h = (h ^ (h >> 29) ^ w[1]) * k;
+	h ^= h >> 32;
+	key = (h & ~(uint64_t)RATELIMIT_FLAGS) | RATELIMIT_VALID;
+
+	line = &ratelimit_table[(h * RATELIMIT_WAYS) & (RATELIMIT_NR_BUCKETS - 1)];
+	for (i = 0; i < RATELIMIT_WAYS; i++) {
+		if ((line[i].key & ~(uint64_t)RATELIMIT_USED) == key)
+			break;
+	}
+
+	if (i < RATELIMIT_WAYS) {
+		bucket = &line[i];
+		bucket->key |= RATELIMIT_USED;
+
+		refill = (uint64_t)(uint32_t)(now - bucket->stamp) * g_rate_limit;
+		if (refill) {
+			refill += bucket->tokens;
+			bucket->tokens = refill < burst ? refill : burst;
+			bucket->stamp = now;
+		}
+	} else {
+		/* New source, the hand clears used bits until it finds a bucket to take */
+		while (1) {
+			bucket = &line[ratelimit_hand++ & (RATELIMIT_WAYS - 1)];
+			if (!(bucket->key & RATELIMIT_USED))
+				break;
+			bucket->key &= ~(uint64_t)RATELIMIT_USED;
+		}
+		bucket->key = key | RATELIMIT_USED;
+		bucket->stamp = now;
+		bucket->tokens = burst;
+	}
+
+	if (bucket->tokens < 1000)
+		return -1;
+	bucket->tokens -= 1000;
+
+	return 0;
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -25,27 +25,45 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <net/if.h>
 #include <arpa/inet.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #define SYSLOG_NAMES		/* Expose syslog.h:prioritynames[] */
 #include "snmpbug.h"
 
-in_port_t g_udp_port=0;
-in_port_t g_tcp_port=0;
-
 static int usage(int rc)
 {
 	printf("Usage: %s [options]\n"
 	       "\n"
+	       "  -a, --aggregate NUM    Sources and communities to sum up instead of logging, default: %d\n"
+	       "  -B, --burst NUM        UDP requests a source may send at once, default: rate limit\n"
+	       "  -b, --batch NUM        UDP datagrams to handle per wakeup, default: %d\n"
+	       "  -c, --max-clients NUM  Maximum number of TCP clients, default: %d\n"
+	       "  -C, --cpus LIST        Pin the workers to these CPUs in turn, e.g. 2,3, default: no\n"
+	       "  -E, --engine NAME      Event loop, epoll or io_uring, default: epoll\n"
 	       "  -h, --help             This help text\n"
 	       "  -i, --interfaces IFACE Network interfaces to monitor, default: none\n"
 	       "  -I, --listen IFACE     Network interface to listen, default: all\n"
+	       "  -l, --log-level LEVEL  Set log level: err, warning, notice, info, debug, default: info\n"
 	       "  -p, --udp-port PORT    UDP port to bind to, default: 161\n"
+	       "  -q, --queue NUM        UDP requests the socket buffers hold, grown on drops, default: system\n"
 	       "  -P, --tcp-port PORT    TCP port to bind to, default is equal to udp port\n"
+	       "  -R, --rate-limit NUM   UDP requests per second to answer per source, default: no limit\n"
+	       "  -r, --read-pcap FILE   Only log requests to the UDP port in a pcap or pcapng FILE\n"
+	       "  -s, --sniff IFACE      Only log requests to the UDP port seen on IFACE, never reply\n"
+	       "  -S, --summary SEC      Seconds between summaries of repeated requests, default: %d\n"
+	       "  -T, --transparent      Answer for any address routed here, e.g. a local route prefix\n"
 	       "  -u, --drop-privs USER  Drop privileges after opening sockets to USER, default: no\n"
 	       "  -v, --version          Show program version and exit\n"
-	       "\n", g_prognm
+	       "  -w, --workers NUM      Worker threads, each with its own sockets, default: 1\n"
+	       "  -y, --busy-poll USEC   Spin for requests this long before sleeping, default: 0\n"
+	       "\n", g_prognm, DEFAULT_NR_AGGREGATES, DEFAULT_UDP_BATCH, DEFAULT_NR_CLIENTS,
+	       DEFAULT_SUMMARY_INTERVAL
 #ifdef HAVE_LIBCONFUSE
 	       , PACKAGE_NAME
 #endif
@@ -63,146 +81,469 @@ static void handle_signal(int UNUSED(signo))
 	g_quit = 1;
 }
 
-static void handle_udp_client(void)
+static void handle_dump_signal(int UNUSED(signo))
 {
-	const char *req_msg = "Failed UDP request from";
-	const char *snd_msg = "Failed UDP response to";
-	my_sockaddr_t sockaddr;
+	g_latency_dump = 1;
+}
+
+static int register_fd(worker_t *worker, int op, int sockfd, uint32_t events, void *ptr)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	return epoll_ctl(worker->epoll_fd, op, sockfd, &ev);
+}
+
+/* Unlink a client from its worker, the caller closes and frees it */
+void remove_tcp_client(worker_t *worker, client_t *client)
+{
+	size_t i = client->index;
+
+	/* Move the last client into the hole, the list is not ordered */
+	worker->tcp_client_list_length--;
+	if (i < worker->tcp_client_list_length) {
+		worker->tcp_client_list[i] = worker->tcp_client_list[worker->tcp_client_list_length];
+		worker->tcp_client_list[i]->index = i;
+	}
+	client->index = (size_t)-1;
+}
+
+/* Unlink the oldest client to make room for a new one, the caller closes it */
+client_t *evict_tcp_client(worker_t *worker)
+{
+	char straddr[my_inet_addrstrlen] = "";
+	client_t *client;
+	size_t i;
+
+	client = find_oldest_client(worker);
+	if (!client)
+		return NULL;
+
+	inet_ntop(my_af_inet, &client->addr, straddr, sizeof(straddr));
+	if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
+		for(i=0; i < (strlen(straddr) - 7); i++) {
+			straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
+		}
+		straddr[i]='\0';  /* set the new termination point */
+	}
+	logit(LOG_WARNING, 0, "Maximum number of %zu clients reached, kicking out %s:%d",
+	      g_max_clients, straddr, client->port);
+	remove_tcp_client(worker, client);
+	STATS_INC(tcp_evictions);
+
+	return client;
+}
+
+/* Create the client control structure for a newly accepted connection */
+client_t *add_tcp_client(worker_t *worker, int sockfd, const my_sockaddr_t *sockaddr)
+{
+	my_sockaddr_t local;
 	my_socklen_t socklen;
-	ssize_t rv; 
-	char straddr[my_inet_addrstrlen] = { 0 };
+	client_t *client;
+	char straddr[my_inet_addrstrlen] = "";
 	size_t i;
 
-	memset(&sockaddr, 0, sizeof(sockaddr));
+	client = allocate(sizeof(client_t));
+	if (!client)
+		return NULL;
 
-	/* Read the whole UDP packet from the socket at once */
-	socklen = sizeof(sockaddr);
-	rv = recvfrom(g_udp_sockfd, g_udp_client.packet, sizeof(g_udp_client.packet),
-		      0, (struct sockaddr *)&sockaddr, &socklen);
-	if (rv == -1) {
-		logit(LOG_WARNING, errno, "Failed receiving UDP request on port %d", g_udp_port);
-		return;
+	client->index = worker->tcp_client_list_length;
+	client->serial = worker->tcp_client_serial++;
+	worker->tcp_client_list[worker->tcp_client_list_length++] = client;
+
+	/* Now fill out the client control structure values */
+	inet_ntop(my_af_inet, &sockaddr->my_sin_addr, straddr, sizeof(straddr));
+	if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
+		for(i=0; i < (strlen(straddr) - 7); i++) {
+			straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
+		}
+		straddr[i]='\0';  /* set the new termination point */
 	}
+	logit(LOG_DEBUG, 0, "Connected TCP client %s:%d", straddr, sockaddr->my_sin_port);
+	STATS_INC(tcp_accepts);
+	client->timestamp = time(NULL);
+	client->timestamp_nsec = -1;
+	client->sockfd = sockfd;
+	client->addr = sockaddr->my_sin_addr;
+	client->port = sockaddr->my_sin_port;
+	client->size = 0;
+	client->outgoing = 0;
+
+	/* Which of our addresses it connected to, for the log */
+	client->local_addr = in6addr_any;
+	socklen = sizeof(local);
+	if (getsockname(sockfd, (struct sockaddr *)&local, &socklen) == 0 && local.my_sin_family == my_af_inet)
+		client->local_addr = local.my_sin_addr;
 
-	g_udp_client.timestamp = time(NULL);
-	g_udp_client.sockfd = g_udp_sockfd;
-	g_udp_client.addr = sockaddr.my_sin_addr;
-	g_udp_client.port = sockaddr.my_sin_port;
-	g_udp_client.size = rv;
-	g_udp_client.outgoing = 0;
+	return client;
+}
+
+/* Run one received UDP datagram through the protocol handler, 0 if there is a reply */
+int handle_udp_request(client_t *client)
+{
+	const char *req_msg = "Failed UDP request from";
+	char straddr[my_inet_addrstrlen] = { 0 };
+	size_t i;
+
+	client->outgoing = 0;
 
 	/* Call the protocol handler which will prepare the response packet */
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
+	inet_ntop(my_af_inet, &client->addr, straddr, sizeof(straddr));
 	if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
 		for(i=0; i < (strlen(straddr) - 7); i++) {
 			straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
 		}
 		straddr[i]='\0';  /* set the new termination point */
 	}
-	if (snmp(&g_udp_client) == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
+	if (snmp(client) == -1) {
+		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, client->port);
+		return -1;
+	}
+	if (client->size == 0) {
+		logit(LOG_WARNING, 0, "%s %s:%d: ignored", req_msg, straddr, client->port);
+		return -1;
+	}
+	client->outgoing = 1;
+
+	return 0;
+}
+
+/* Ask for a socket buffer of size bytes, what the kernel granted; root may go past net.core.[rw]mem_max */
+static int size_udp_buffer(int sockfd, int optname, int size)
+{
+	int half = size / 2;	/* The kernel doubles it for its bookkeeping */
+	socklen_t len = sizeof(size);
+
+	if (size) {
+#ifdef SO_RCVBUFFORCE
+		if (setsockopt(sockfd, SOL_SOCKET, optname == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE,
+			       &half, sizeof(half)) == -1)
+#endif
+			setsockopt(sockfd, SOL_SOCKET, optname, &half, sizeof(half));
+	}
+
+	if (getsockopt(sockfd, SOL_SOCKET, optname, &size, &len) == -1)
+		return 0;
+
+	return size;
+}
+
+/*
+ * Double a UDP socket buffer of the worker after the kernel had no room
+ * for a datagram, at most once a second and up to MAX_UDP_BUFFER.  The
+ * drops of a socket include what its filter rejected, which needs no
+ * room, so the receive buffer is only grown when the overflow count of
+ * the namespace, as stats_socket() last read it, went up as well.  When
+ * that count is not available any drop still grows it.
+ */
+void grow_udp_buffer(worker_t *worker, int optname)
+{
+	int *size = optname == SO_RCVBUF ? &worker->udp_rcvbuf : &worker->udp_sndbuf;
+	const char *name = optname == SO_RCVBUF ? "receive" : "send";
+	time_t now = time(NULL);
+	int granted;
+
+	if (*size >= MAX_UDP_BUFFER || now == worker->udp_grown)
 		return;
+	if (optname == SO_RCVBUF && worker->udp_overflows != UDP_OVERFLOWS_UNKNOWN) {
+		if (worker->udp_overflows == worker->udp_overflows_grown)
+			return;
+		worker->udp_overflows_grown = worker->udp_overflows;
 	}
-	if (g_udp_client.size == 0) {
-		logit(LOG_WARNING, 0, "%s %s:%d: ignored", req_msg, straddr, sockaddr.my_sin_port);
+	worker->udp_grown = now;
+
+	granted = size_udp_buffer(worker->udp_sockfd, optname,
+				  *size < MAX_UDP_BUFFER / 2 ? *size * 2 : MAX_UDP_BUFFER);
+	if (granted <= *size) {
+		logit(LOG_WARNING, 0, "could not grow UDP %s buffer of worker %d past %d bytes, "
+		      "raise net.core.%cmem_max", name, worker->id, *size, name[0] == 'r' ? 'r' : 'w');
+		*size = MAX_UDP_BUFFER;		/* Do not try again */
 		return;
 	}
-	g_udp_client.outgoing = 1;
 
-	/* Send the whole UDP packet to the socket at once */
-	rv = sendto(g_udp_sockfd, g_udp_client.packet, g_udp_client.size,
-		    MSG_DONTWAIT, (struct sockaddr *)&sockaddr, socklen);
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
-	if (rv == -1)
-		logit(LOG_WARNING, errno, "%s %s:%d", snd_msg, straddr, sockaddr.my_sin_port);
-	else if ((size_t)rv != g_udp_client.size)
-		logit(LOG_WARNING, 0, "%s %s:%d: only %zd of %zu bytes sent", snd_msg, straddr, sockaddr.my_sin_port, rv, g_udp_client.size);
+	logit(LOG_NOTICE, 0, "Dropping UDP datagrams, grew %s buffer of worker %d to %d bytes",
+	      name, worker->id, granted);
+	*size = granted;
 }
 
-static void handle_tcp_connect(void)
+/*
+ * When the kernel received a datagram, from its SCM_TIMESTAMPNS, or at
+ * least the second.  Once the socket dropped any, SO_RXQ_OVFL tells how
+ * many so far with every datagram, and if the buffer overflowed we make
+ * room for more.
+ *
+ * IPV6_PKTINFO tells which of our addresses it was sent to, for IPv4
+ * IP_PKTINFO also the one to answer from: a broadcast or multicast
+ * destination can not be the source of the reply.
+ */
+void handle_udp_control(worker_t *worker, client_t *client, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+	struct in6_pktinfo pktinfo6;
+	struct in_pktinfo pktinfo;
+	uint32_t dropped;
+
+	client->timestamp = 0;
+	client->local_addr = in6addr_any;
+	client->reply_addr = in6addr_any;
+	client->reply_ifindex = 0;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+			memcpy(&pktinfo6, CMSG_DATA(cmsg), sizeof(pktinfo6));
+			client->local_addr = pktinfo6.ipi6_addr;
+			if (IN6_IS_ADDR_V4MAPPED(&pktinfo6.ipi6_addr) || IN6_IS_ADDR_MULTICAST(&pktinfo6.ipi6_addr))
+				continue;
+
+			client->reply_addr = pktinfo6.ipi6_addr;
+			if (IN6_IS_ADDR_LINKLOCAL(&pktinfo6.ipi6_addr))
+				client->reply_ifindex = pktinfo6.ipi6_ifindex;
+		}
+		if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+			memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+			client->local_addr = in6addr_any;
+			client->local_addr.s6_addr[10] = 0xFF;
+			client->local_addr.s6_addr[11] = 0xFF;
+			client->reply_addr = client->local_addr;
+			memcpy(&client->local_addr.s6_addr[12], &pktinfo.ipi_addr, 4);
+			memcpy(&client->reply_addr.s6_addr[12], &pktinfo.ipi_spec_dst, 4);
+		}
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			client->timestamp = ts.tv_sec;
+			client->timestamp_nsec = ts.tv_nsec;
+		}
+#ifdef SO_RXQ_OVFL
+		if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+			if (dropped == worker->udp_dropped)
+				continue;
+
+			/* The count when the datagram was queued, stats_socket() may know better */
+			worker->udp_dropped = dropped;
+			if (dropped > g_stats->kernel_dropped)
+				__atomic_store_n(&g_stats->kernel_dropped, dropped, __ATOMIC_RELAXED);
+			grow_udp_buffer(worker, SO_RCVBUF);
+		}
+#endif
+	}
+
+	if (!client->timestamp) {
+		client->timestamp = time(NULL);
+		client->timestamp_nsec = -1;
+	}
+}
+
+/*
+ * Have the reply to a UDP request leave from the address the request was
+ * sent to, not whichever the routing table picks for the way back, which
+ * gives away a host answering for many addresses.  The interface is only
+ * kept for link-local addresses, otherwise routing still picks it.
+ */
+void handle_udp_source(const client_t *client, struct msghdr *msg, char *control)
+{
+	struct cmsghdr *cmsg = (struct cmsghdr *)control;
+	struct in6_pktinfo pktinfo6;
+	struct in_pktinfo pktinfo;
+
+	msg->msg_control = NULL;
+	msg->msg_controllen = 0;
+	if (IN6_IS_ADDR_UNSPECIFIED(&client->reply_addr))
+		return;
+
+	memset(control, 0, UDP_CONTROL_SIZE);
+	if (g_family == AF_INET) {
+		memset(&pktinfo, 0, sizeof(pktinfo));
+		memcpy(&pktinfo.ipi_spec_dst, &client->reply_addr.s6_addr[12], 4);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(pktinfo));
+		memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+		msg->msg_controllen = CMSG_SPACE(sizeof(pktinfo));
+	} else {
+		/* IPv4 mapped addresses too, the kernel takes them for IPv4 replies */
+		pktinfo6.ipi6_addr = client->reply_addr;
+		pktinfo6.ipi6_ifindex = client->reply_ifindex;
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(pktinfo6));
+		memcpy(CMSG_DATA(cmsg), &pktinfo6, sizeof(pktinfo6));
+		msg->msg_controllen = CMSG_SPACE(sizeof(pktinfo6));
+	}
+	msg->msg_control = control;
+}
+
+static void handle_udp_client(worker_t *worker)
+{
+	const char *snd_msg = "Failed UDP response to";
+	my_sockaddr_t sockaddr_list[MAX_UDP_BATCH];
+	struct mmsghdr rx_list[MAX_UDP_BATCH];
+	struct mmsghdr tx_list[MAX_UDP_BATCH];
+	struct iovec iov_list[MAX_UDP_BATCH];
+	char control_list[MAX_UDP_BATCH][UDP_CONTROL_SIZE];
+	client_t *client;
+	char straddr[my_inet_addrstrlen] = { 0 };
+	int rv, tx_len, sent;
+	uint32_t now = 0;
+	uint64_t stamp;
+	struct timespec now_ts;
+	size_t i;
+
+	/*
+	 * Drain up to g_udp_batch datagrams with a single system call, each
+	 * one lands in its own client buffer so the replies can be built in
+	 * place and flushed together with one sendmmsg() below.
+	 */
+	memset(rx_list, 0, g_udp_batch * sizeof(rx_list[0]));
+	for (i = 0; i < g_udp_batch; i++) {
+		iov_list[i].iov_base = worker->udp_client_list[i].packet;
+		iov_list[i].iov_len = sizeof(worker->udp_client_list[i].packet);
+		rx_list[i].msg_hdr.msg_name = &sockaddr_list[i];
+		rx_list[i].msg_hdr.msg_namelen = sizeof(sockaddr_list[i]);
+		rx_list[i].msg_hdr.msg_iov = &iov_list[i];
+		rx_list[i].msg_hdr.msg_iovlen = 1;
+		rx_list[i].msg_hdr.msg_control = control_list[i];
+		rx_list[i].msg_hdr.msg_controllen = sizeof(control_list[i]);
+	}
+
+	LATENCY_STAMP(stamp);
+	rv = recvmmsg(worker->udp_sockfd, rx_list, g_udp_batch, MSG_DONTWAIT, NULL);
+	LATENCY_PHASE(LATENCY_RECV, stamp);
+	if (rv == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			logit(LOG_WARNING, errno, "Failed receiving UDP request on port %d", g_udp_port);
+		return;
+	}
+	LATENCY_REALTIME(now_ts);
+
+	if (g_rate_limit)
+		now = ratelimit_clock();
+
+	tx_len = 0;
+	for (i = 0; i < (size_t)rv; i++) {
+		STATS_INC(packets_in);
+		STATS_ADD(bytes_in, rx_list[i].msg_len);
+
+		client = &worker->udp_client_list[i];
+		handle_udp_control(worker, client, &rx_list[i].msg_hdr);
+		LATENCY_ARRIVAL(LATENCY_QUEUE, client, now_ts);
+
+		/* Over its budget, the source is not worth decoding let alone answering */
+		if (g_rate_limit && ratelimit(&sockaddr_list[i].my_sin_addr, now) == -1) {
+			STATS_INC(rate_limited);
+			continue;
+		}
+
+		client->sockfd = worker->udp_sockfd;
+		client->addr = sockaddr_list[i].my_sin_addr;
+		client->port = sockaddr_list[i].my_sin_port;
+		client->size = rx_list[i].msg_len;
+
+		if (handle_udp_request(client) == -1)
+			continue;
+
+		/* Queue the response, reusing the receive iovec and peer address */
+		iov_list[i].iov_len = client->size;
+		tx_list[tx_len].msg_hdr = rx_list[i].msg_hdr;
+		handle_udp_source(client, &tx_list[tx_len].msg_hdr, control_list[i]);
+		tx_list[tx_len].msg_len = 0;
+		tx_len++;
+	}
+
+	/* Send all queued UDP responses at once, skipping over any that fail */
+	LATENCY_STAMP(stamp);
+	for (sent = 0; sent < tx_len; sent += rv) {
+		rv = sendmmsg(worker->udp_sockfd, &tx_list[sent], tx_len - sent, MSG_DONTWAIT);
+		if (rv == -1) {
+			my_sockaddr_t *sockaddr = tx_list[sent].msg_hdr.msg_name;
+
+			inet_ntop(my_af_inet, &sockaddr->my_sin_addr, straddr, sizeof(straddr));
+			rv = errno;
+			logit(LOG_WARNING, rv, "%s %s:%d", snd_msg, straddr, sockaddr->my_sin_port);
+			if (rv == EAGAIN || rv == EWOULDBLOCK || rv == ENOBUFS)
+				grow_udp_buffer(worker, SO_SNDBUF);
+			rv = 1;
+		}
+	}
+	if (tx_len) {
+		LATENCY_PHASE(LATENCY_SEND, stamp);
+		LATENCY_REALTIME(now_ts);
+	}
+
+	for (i = 0; i < (size_t)tx_len; i++) {
+		my_sockaddr_t *sockaddr = tx_list[i].msg_hdr.msg_name;
+		size_t size = tx_list[i].msg_hdr.msg_iov->iov_len;
+
+		if (tx_list[i].msg_len) {
+			STATS_INC(packets_out);
+			STATS_ADD(bytes_out, tx_list[i].msg_len);
+			client = &worker->udp_client_list[tx_list[i].msg_hdr.msg_iov - iov_list];
+			LATENCY_ARRIVAL(LATENCY_RESPONSE, client, now_ts);
+		}
+		if (tx_list[i].msg_len && tx_list[i].msg_len != size) {
+			inet_ntop(my_af_inet, &sockaddr->my_sin_addr, straddr, sizeof(straddr));
+			logit(LOG_WARNING, 0, "%s %s:%d: only %u of %zu bytes sent", snd_msg, straddr,
+			      sockaddr->my_sin_port, tx_list[i].msg_len, size);
+		}
+	}
+}
+
+static void handle_tcp_connect(worker_t *worker)
 {
 	const char *msg = "Could not accept TCP connection";
-	my_sockaddr_t tmp_sockaddr;
 	my_sockaddr_t sockaddr;
 	my_socklen_t socklen;
 	client_t *client;
-	char straddr[my_inet_addrstrlen] = "";
-	int rv; size_t i;
+	int rv;
 
-	memset(&tmp_sockaddr, 0, sizeof(tmp_sockaddr));
 	memset(&sockaddr, 0, sizeof(sockaddr));
 
 	/* Accept the new connection (remember the client's IP address and port) */
 	socklen = sizeof(sockaddr);
-	rv = accept(g_tcp_sockfd, (struct sockaddr *)&sockaddr, &socklen);
+	rv = accept(worker->tcp_sockfd, (struct sockaddr *)&sockaddr, &socklen);
 	if (rv == -1) {
 		logit(LOG_ERR, errno, "%s", msg);
 		return;
 	}
-	if (rv >= FD_SETSIZE) {
-		logit(LOG_ERR, 0, "%s: FD set overflow", msg);
-		close(rv);
-		return;
-	}
 
-	/* Create a new client control structure or overwrite the oldest one */
-	if (g_tcp_client_list_length >= MAX_NR_CLIENTS) {
-		client = find_oldest_client();
+	/* Make room for the new client by kicking out the oldest one */
+	if (worker->tcp_client_list_length >= g_max_clients) {
+		client = evict_tcp_client(worker);
 		if (!client) {
 			logit(LOG_ERR, 0, "%s: internal error", msg);
 			exit(EXIT_SYSCALL);
 		}
 
-		tmp_sockaddr.my_sin_addr = client->addr;
-		tmp_sockaddr.my_sin_port = client->port;
-		inet_ntop(my_af_inet, &tmp_sockaddr.my_sin_addr, straddr, sizeof(straddr));
-		if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
-			for(i=0; i < (strlen(straddr) - 7); i++) {
-				straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
-			}
-			straddr[i]='\0';  /* set the new termination point */
-		}
-		logit(LOG_WARNING, 0, "Maximum number of %d clients reached, kicking out %s:%d",
-		      MAX_NR_CLIENTS, straddr, tmp_sockaddr.my_sin_port);
 		close(client->sockfd);
-	} else {
-		client = allocate(sizeof(client_t));
-		if (!client)
-			exit(EXIT_SYSCALL);
-
-		g_tcp_client_list[g_tcp_client_list_length++] = client;
+		free(client);
 	}
 
-	/* Now fill out the client control structure values */
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
-	if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
-		for(i=0; i < (strlen(straddr) - 7); i++) {
-			straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
-		}
-		straddr[i]='\0';  /* set the new termination point */
+	client = add_tcp_client(worker, rv, &sockaddr);
+	if (!client)
+		exit(EXIT_SYSCALL);
+
+	if (register_fd(worker, EPOLL_CTL_ADD, client->sockfd, EPOLLIN, client) == -1) {
+		logit(LOG_ERR, errno, "%s: failed registering client", msg);
+		close(client->sockfd);
+		remove_tcp_client(worker, client);
+		free(client);
 	}
-	logit(LOG_DEBUG, 0, "Connected TCP client %s:%d", straddr, sockaddr.my_sin_port);
-	client->timestamp = time(NULL);
-	client->sockfd = rv;
-	client->addr = sockaddr.my_sin_addr;
-	client->port = sockaddr.my_sin_port;
-	client->size = 0;
-	client->outgoing = 0;
 }
 
-static void handle_tcp_client_write(client_t *client)
+/* Check the result of sending a TCP response, closes the socket on failure */
+void handle_tcp_client_sent(client_t *client, ssize_t rv)
 {
 	const char *msg = "Failed TCP response to";
-	ssize_t rv;
 	char straddr[my_inet_addrstrlen] = "";
-	my_sockaddr_t sockaddr;
 	size_t i;
 
-	/* Send the packet atomically and close socket if that did not work */
-	sockaddr.my_sin_addr = client->addr;
-	sockaddr.my_sin_port = client->port;
-	rv = send(client->sockfd, client->packet, client->size, 0);
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
+	inet_ntop(my_af_inet, &client->addr, straddr, sizeof(straddr));
 	if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
 		for(i=0; i < (strlen(straddr) - 7); i++) {
 			straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
@@ -210,37 +551,44 @@ static void handle_tcp_client_write(client_t *client)
 		straddr[i]='\0';  /* set the new termination point */
 	}
 	if (rv == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", msg, straddr, sockaddr.my_sin_port);
+		logit(LOG_WARNING, errno, "%s %s:%d", msg, straddr, client->port);
 		close(client->sockfd);
 		client->sockfd = -1;
 		return;
 	}
 	if ((size_t)rv != client->size) {
 		logit(LOG_WARNING, 0, "%s %s:%d: only %zd of %zu bytes written",
-		      msg, straddr, sockaddr.my_sin_port, rv, client->size);
+		      msg, straddr, client->port, rv, client->size);
 		close(client->sockfd);
 		client->sockfd = -1;
 		return;
 	}
 
+	STATS_INC(packets_out);
+	STATS_ADD(bytes_out, rv);
+
 	/* Put the client into listening mode again */
 	client->size = 0;
 	client->outgoing = 0;
 }
 
-static void handle_tcp_client_read(client_t *client)
+static void handle_tcp_client_write(client_t *client)
+{
+	ssize_t rv;
+
+	/* Send the packet atomically and close socket if that did not work */
+	rv = send(client->sockfd, client->packet, client->size, 0);
+	handle_tcp_client_sent(client, rv);
+}
+
+/* Account for data received on a TCP client, handles the request once complete */
+void handle_tcp_client_received(client_t *client, ssize_t rv)
 {
 	const char *req_msg = "Failed TCP request from";
-	int rv;
 	char straddr[my_inet_addrstrlen] = "";
-	my_sockaddr_t sockaddr;
 	size_t i;
 
-	/* Read from the socket what arrived and put it into the buffer */
-	sockaddr.my_sin_addr = client->addr;
-	sockaddr.my_sin_port = client->port;
-	rv = read(client->sockfd, client->packet + client->size, sizeof(client->packet) - client->size);
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
+	inet_ntop(my_af_inet, &client->addr, straddr, sizeof(straddr));
 	if (strncmp(straddr,"::ffff:",7)==0) {	/* ipv4-in-ipv6 representation */
 		for(i=0; i < (strlen(straddr) - 7); i++) {
 			straddr[i] = straddr[(i+7)];  /* shift the IPv4 addr to the beginning of the string */
@@ -248,25 +596,26 @@ static void handle_tcp_client_read(client_t *client)
 		straddr[i]='\0';  /* set the new termination point */
 	}
 	if (rv == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
+		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, client->port);
 		close(client->sockfd);
 		client->sockfd = -1;
 		return;
 	}
 	if (rv == 0) {
 		logit(LOG_DEBUG, 0, "TCP client %s:%d disconnected",
-		      straddr, sockaddr.my_sin_port);
+		      straddr, client->port);
 		close(client->sockfd);
 		client->sockfd = -1;
 		return;
 	}
 	client->timestamp = time(NULL);
+	client->timestamp_nsec = -1;
 	client->size += rv;
 
 	/* Check whether the packet was fully received and handle packet if yes */
 	rv = snmp_packet_complete(client);
 	if (rv == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
+		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, client->port);
 		close(client->sockfd);
 		client->sockfd = -1;
 		return;
@@ -275,16 +624,18 @@ static void handle_tcp_client_read(client_t *client)
 		return;
 	}
 	client->outgoing = 0;
+	STATS_INC(packets_in);
+	STATS_ADD(bytes_in, client->size);
 
 	/* Call the protocol handler which will prepare the response packet */
 	if (snmp(client) == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
+		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, client->port);
 		close(client->sockfd);
 		client->sockfd = -1;
 		return;
 	}
 	if (client->size == 0) {
-		logit(LOG_WARNING, 0, "%s %s:%d: ignored", req_msg, straddr, sockaddr.my_sin_port);
+		logit(LOG_WARNING, 0, "%s %s:%d: ignored", req_msg, straddr, client->port);
 		close(client->sockfd);
 		client->sockfd = -1;
 		return;
@@ -293,6 +644,427 @@ static void handle_tcp_client_read(client_t *client)
 	client->outgoing = 1;
 }
 
+static void handle_tcp_client_read(client_t *client)
+{
+	ssize_t rv;
+
+	/* Read from the socket what arrived and put it into the buffer */
+	rv = read(client->sockfd, client->packet + client->size, sizeof(client->packet) - client->size);
+	handle_tcp_client_received(client, rv);
+}
+
+#ifdef SO_ATTACH_FILTER
+/*
+ * Classic BPF run by the kernel on every datagram before it is queued,
+ * loads are relative to the UDP header.  Only what decode_snmp_request()
+ * could take for an SNMPv1/v2c message gets through: a SEQUENCE with a
+ * length of one, two or three bytes that covers exactly the rest of the
+ * datagram, starting with the INTEGER version 0 or 1.  Anything else is
+ * dropped without waking us up and counted in the socket's drops.
+ */
+#define UDP_FILTER_DROP(i)	(29 - (i) - 1)	/* Jump offset from insn i to the drop */
+
+static const struct sock_filter udp_filter[] = {
+	/*  0 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+	/*  1 */ BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 8 + MAX_PACKET_SIZE, UDP_FILTER_DROP(1), 0),
+	/*  2 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8),
+	/*  3 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BER_TYPE_SEQUENCE, 0, UDP_FILTER_DROP(3)),
+	/*  4 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+	/*  5 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x80, 2, 0),
+	/*  6 */ BPF_STMT(BPF_LDX | BPF_IMM, 2),		/* Short form, X = header length */
+	/*  7 */ BPF_STMT(BPF_JMP | BPF_JA, 7),
+	/*  8 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x81, 0, 3),
+	/*  9 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 10),
+	/* 10 */ BPF_STMT(BPF_LDX | BPF_IMM, 3),
+	/* 11 */ BPF_STMT(BPF_JMP | BPF_JA, 3),
+	/* 12 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x82, 0, UDP_FILTER_DROP(12)),
+	/* 13 */ BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 10),
+	/* 14 */ BPF_STMT(BPF_LDX | BPF_IMM, 4),
+	/* 15 */ BPF_STMT(BPF_STX, 0),			/* A = length, X = header length */
+	/* 16 */ BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+	/* 17 */ BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 8),
+	/* 18 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	/* 19 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+	/* 20 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, 0, UDP_FILTER_DROP(20)),
+	/* 21 */ BPF_STMT(BPF_LDX | BPF_MEM, 0),
+	/* 22 */ BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8),
+	/* 23 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, BER_TYPE_INTEGER, 0, UDP_FILTER_DROP(23)),
+	/* 24 */ BPF_STMT(BPF_LD | BPF_B | BPF_IND, 9),
+	/* 25 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, UDP_FILTER_DROP(25)),
+	/* 26 */ BPF_STMT(BPF_LD | BPF_B | BPF_IND, 10),
+	/* 27 */ BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, SNMP_VERSION_2C, UDP_FILTER_DROP(27), 0),
+	/* 28 */ BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+	/* 29 */ BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static void filter_udp_socket(int sockfd)
+{
+	struct sock_fprog prog;
+
+	prog.len = NELEMS(udp_filter);
+	prog.filter = (struct sock_filter *)udp_filter;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+		logit(LOG_WARNING, errno, "could not attach filter to UDP socket, decoding all datagrams");
+}
+#endif
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+/*
+ * Have the kernel pick the worker socket of a datagram or connection by
+ * a hash of its source address, rather than of address and port, so a
+ * source always ends up with the same worker.  The per worker tables
+ * (rate limits, aggregates) then each hold a disjoint set of sources.
+ * The program returns an index into the reuseport group, which is in
+ * the order the sockets were bound, that of the workers.
+ */
+static void steer_socket(int sockfd, const char *proto)
+{
+	struct sock_filter steer[] = {
+		/*  0 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),
+		/*  1 */ BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+		/*  2 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 11),
+		/*  3 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),	/* IPv6 source, folded */
+		/*  4 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		/*  5 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		/*  6 */ BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		/*  7 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		/*  8 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+		/*  9 */ BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		/* 10 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		/* 11 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+		/* 12 */ BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		/* 13 */ BPF_STMT(BPF_JMP | BPF_JA, 1),
+		/* 14 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),	/* IPv4 source */
+		/* 15 */ BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9E3779B1),
+		/* 16 */ BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		/* 17 */ BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, g_worker_list_length),
+		/* 18 */ BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog;
+
+	prog.len = NELEMS(steer);
+	prog.filter = steer;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1)
+		logit(LOG_WARNING, errno, "could not steer %s sources to workers, a source may be "
+		      "handled by several", proto);
+}
+#endif
+
+static int open_socket(int type, in_port_t port)
+{
+	const char *proto = (type == SOCK_DGRAM) ? "UDP" : "TCP";
+	struct ifreq ifreq;
+	my_socklen_t socklen;
+	union {
+		struct sockaddr_in sa;
+		struct sockaddr_in6 sa6;
+	} sockaddr;
+	int sockfd, c;
+
+	sockfd = socket((g_family == AF_INET) ? PF_INET : PF_INET6, type, 0);
+	if (sockfd == -1) {
+		logit(LOG_ERR, errno, "could not create %s socket", proto);
+		exit(EXIT_SYSCALL);
+	}
+
+#ifndef __FreeBSD__
+	if (g_bind_to_device) {
+		snprintf(ifreq.ifr_ifrn.ifrn_name, sizeof(ifreq.ifr_ifrn.ifrn_name), "%s", g_bind_to_device);
+		if (setsockopt(sockfd, SOL_SOCKET, SO_BINDTODEVICE, (char *)&ifreq, sizeof(ifreq)) == -1) {
+			logit(LOG_WARNING, errno, "could not bind %s socket to device %s", proto, g_bind_to_device);
+			exit(EXIT_SYSCALL);
+		}
+	}
+#endif
+
+	c = 1;
+	if (type == SOCK_STREAM && setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &c, sizeof(c)) == -1) {
+		logit(LOG_WARNING, errno, "could not set SO_REUSEADDR on %s socket", proto);
+		exit(EXIT_SYSCALL);
+	}
+
+	/* Have every datagram stamped with when it arrived, failing that we know the second */
+	if (type == SOCK_DGRAM && setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &c, sizeof(c)) == -1)
+		logit(LOG_WARNING, errno, "could not set SO_TIMESTAMPNS on %s socket", proto);
+
+	/* And with the address it was sent to, IPv4 ones on an IPv6 socket too */
+	if (type == SOCK_DGRAM && ((g_family == AF_INET6 &&
+	     setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &c, sizeof(c)) == -1) ||
+	    setsockopt(sockfd, IPPROTO_IP, IP_PKTINFO, &c, sizeof(c)) == -1))
+		logit(LOG_WARNING, errno, "could not set IP_PKTINFO on %s socket, replies may leave "
+		      "from another address", proto);
+
+#ifdef SO_RXQ_OVFL
+	/* And with how many it dropped so far, once it dropped any */
+	if (type == SOCK_DGRAM && setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &c, sizeof(c)) == -1)
+		logit(LOG_WARNING, errno, "could not set SO_RXQ_OVFL on %s socket", proto);
+#endif
+
+#ifdef SO_ATTACH_FILTER
+	if (type == SOCK_DGRAM)
+		filter_udp_socket(sockfd);
+#endif
+
+#ifdef SO_BUSY_POLL
+	/* Have receives poll the device queue a while, more than net.core.busy_read needs CAP_NET_ADMIN */
+	if (g_busy_poll && setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &g_busy_poll, sizeof(g_busy_poll)) == -1)
+		logit(LOG_WARNING, errno, "could not set SO_BUSY_POLL on %s socket", proto);
+#ifdef SO_PREFER_BUSY_POLL
+	if (g_busy_poll)
+		setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &c, sizeof(c));
+#endif
+#endif
+
+	/*
+	 * Answer from addresses no interface has, e.g. a darknet prefix routed
+	 * to us with 'ip route add local 192.0.2.0/24 dev lo'.  IPv4 replies
+	 * from such AnyIP addresses work as is, IPv6 ones need IP_FREEBIND.
+	 * IP_TRANSPARENT also takes what TPROXY diverts to us, but needs
+	 * CAP_NET_ADMIN.  Both cover IPv6 sockets too.
+	 */
+	if (g_transparent) {
+		if (setsockopt(sockfd, IPPROTO_IP, IP_FREEBIND, &c, sizeof(c)) == -1) {
+			logit(LOG_ERR, errno, "could not set IP_FREEBIND on %s socket", proto);
+			exit(EXIT_SYSCALL);
+		}
+		if (setsockopt(sockfd, IPPROTO_IP, IP_TRANSPARENT, &c, sizeof(c)) == -1)
+			logit(LOG_WARNING, errno, "could not set IP_TRANSPARENT on %s socket, "
+			      "only answering for local routes", proto);
+	}
+
+	/* Let the kernel spread the load over the workers' sockets */
+	if (g_worker_list_length > 1 && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &c, sizeof(c)) == -1) {
+		logit(LOG_WARNING, errno, "could not set SO_REUSEPORT on %s socket", proto);
+		exit(EXIT_SYSCALL);
+	}
+
+	if (g_family == AF_INET) {
+		sockaddr.sa.sin_family = g_family;
+		sockaddr.sa.sin_port = htons(port);
+		sockaddr.sa.sin_addr = inaddr_any;
+		socklen = sizeof(sockaddr.sa);
+	} else {
+		sockaddr.sa6.sin6_family = g_family;
+		sockaddr.sa6.sin6_port = htons(port);
+		sockaddr.sa6.sin6_addr = in6addr_any;
+		socklen = sizeof(sockaddr.sa6);
+	}
+	if (bind(sockfd, (struct sockaddr *)&sockaddr, socklen) == -1) {
+		logit(LOG_ERR, errno, "could not bind %s socket to port %d", proto, port);
+		exit(EXIT_SYSCALL);
+	}
+
+	if (type == SOCK_STREAM && listen(sockfd, 128) == -1) {
+		logit(LOG_ERR, errno, "could not prepare %s socket for listening", proto);
+		exit(EXIT_SYSCALL);
+	}
+
+	return sockfd;
+}
+
+static void open_worker(worker_t *worker, int id)
+{
+	memset(worker, 0, sizeof(*worker));
+	worker->id = id;
+
+	worker->tcp_client_list = allocate(g_max_clients * sizeof(worker->tcp_client_list[0]));
+	if (!worker->tcp_client_list)
+		exit(EXIT_SYSCALL);
+
+	/* Open the server's UDP and TCP ports and prepare them for listening */
+	worker->udp_sockfd = open_socket(SOCK_DGRAM, g_udp_port);
+	worker->tcp_sockfd = open_socket(SOCK_STREAM, g_tcp_port);
+
+	/* Room for g_udp_queue requests and their replies, if asked for, grown on drops */
+	worker->udp_rcvbuf = size_udp_buffer(worker->udp_sockfd, SO_RCVBUF, g_udp_queue * UDP_TRUESIZE);
+	worker->udp_sndbuf = size_udp_buffer(worker->udp_sockfd, SO_SNDBUF, g_udp_queue * UDP_TRUESIZE);
+	if ((size_t)worker->udp_rcvbuf < g_udp_queue * UDP_TRUESIZE && id == 0)
+		logit(LOG_WARNING, 0, "UDP receive buffer only holds %d bytes of %zu asked for, "
+		      "raise net.core.rmem_max", worker->udp_rcvbuf, g_udp_queue * UDP_TRUESIZE);
+	worker->udp_overflows = worker->udp_overflows_grown = stats_udp_overflows();
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	/* The group shares the program, set it before anybody else joins */
+	if (id == 0 && g_worker_list_length > 1) {
+		steer_socket(worker->udp_sockfd, "UDP");
+		steer_socket(worker->tcp_sockfd, "TCP");
+	}
+#endif
+
+	if (g_engine == ENGINE_URING) {
+		if (uring_open(worker) == -1)
+			exit(EXIT_SYSCALL);
+		return;
+	}
+
+	/* Register the server sockets once, TCP clients are added on accept */
+	worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (worker->epoll_fd == -1) {
+		logit(LOG_ERR, errno, "could not create epoll instance");
+		exit(EXIT_SYSCALL);
+	}
+
+	if (register_fd(worker, EPOLL_CTL_ADD, worker->udp_sockfd, EPOLLIN, &worker->udp_sockfd) == -1 ||
+	    register_fd(worker, EPOLL_CTL_ADD, worker->tcp_sockfd, EPOLLIN, &worker->tcp_sockfd) == -1) {
+		logit(LOG_ERR, errno, "could not register sockets for polling");
+		exit(EXIT_SYSCALL);
+	}
+}
+
+/* Keep the calling thread on the CPU of worker id, if we were given any */
+void pin_thread(size_t id)
+{
+	cpu_set_t set;
+	int cpu, rc;
+
+	if (!g_cpu_list_length)
+		return;
+
+	cpu = g_cpu_list[id % g_cpu_list_length];
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc)
+		logit(LOG_WARNING, rc, "could not pin worker %zu to CPU %d", id, cpu);
+}
+
+/*
+ * Poll without sleeping for up to g_busy_poll us, so a request that comes
+ * in meanwhile is picked up without waiting for the scheduler to wake us,
+ * then sleep as usual.
+ */
+static int wait_events(worker_t *worker, struct epoll_event *events, int maxevents, int timeout)
+{
+	struct timespec start, now;
+	int nfds;
+
+	if (!g_busy_poll)
+		return epoll_wait(worker->epoll_fd, events, maxevents, timeout);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		nfds = epoll_wait(worker->epoll_fd, events, maxevents, 0);
+		if (nfds)
+			return nfds;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (!g_quit && (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 < g_busy_poll);
+
+	return epoll_wait(worker->epoll_fd, events, maxevents, timeout);
+}
+
+static void *run_worker(void *arg)
+{
+	worker_t *worker = arg;
+	struct epoll_event events[MAX_NR_EVENTS];
+	struct timeval tv_last;
+	struct timeval tv_now;
+	int ticks, nfds, i, connects, timeout;
+
+	pin_thread(worker->id);
+	stats_thread(worker->id);
+	latency_thread(worker->id);
+
+	/* Store the starting time since we need it for MIB updates */
+	if (gettimeofday(&tv_last, NULL) == -1) {
+		memset(&tv_last, 0, sizeof(tv_last));
+		timeout = 0;
+	} else {
+		timeout = g_timeout * 10;
+	}
+
+	/* Handle incoming connect requests and incoming data */
+	while (!g_quit) {
+		latency_poll();
+
+		/* Sleep until we get a request or the timeout is over */
+		nfds = wait_events(worker, events, NELEMS(events), timeout);
+		if (nfds == -1) {
+			if (g_quit)
+				break;
+			if (errno == EINTR)
+				continue;
+
+			logit(LOG_ERR, errno, "could not poll sockets");
+			exit(EXIT_SYSCALL);
+		}
+
+		/* Determine whether to update the MIB and the next ticks to sleep */
+		ticks = ticks_since(&tv_last, &tv_now);
+		if (ticks < 0 || ticks >= g_timeout) {
+			memcpy(&tv_last, &tv_now, sizeof(tv_now));
+			timeout = g_timeout * 10;
+			aggregate_flush(tv_now.tv_sec, 0);
+			stats_socket(worker, tv_now.tv_sec);
+		} else {
+			timeout = (g_timeout - ticks) * 10;
+		}
+
+		/*
+		 * Handle UDP packets and TCP packets, then TCP connection
+		 * connects: accepting may recycle the oldest client, which
+		 * could otherwise still have a stale event in this batch.
+		 */
+		connects = 0;
+		for (i = 0; i < nfds; i++) {
+			client_t *client;
+			int outgoing;
+
+			if (events[i].data.ptr == &worker->udp_sockfd) {
+				handle_udp_client(worker);
+				continue;
+			}
+			if (events[i].data.ptr == &worker->tcp_sockfd) {
+				connects = 1;
+				continue;
+			}
+
+			client = events[i].data.ptr;
+			outgoing = client->outgoing;
+			if (outgoing)
+				handle_tcp_client_write(client);
+			else
+				handle_tcp_client_read(client);
+
+			/* If there was a TCP disconnect, remove the client from the list */
+			if (client->sockfd == -1) {
+				remove_tcp_client(worker, client);
+				free(client);
+				continue;
+			}
+
+			/* Otherwise wait for the socket to become readable/writable next */
+			if (client->outgoing != outgoing &&
+			    register_fd(worker, EPOLL_CTL_MOD, client->sockfd,
+					client->outgoing ? EPOLLOUT : EPOLLIN, client) == -1) {
+				logit(LOG_WARNING, errno, "could not update TCP client polling");
+				close(client->sockfd);
+				remove_tcp_client(worker, client);
+				free(client);
+			}
+		}
+
+		if (connects)
+			handle_tcp_connect(worker);
+	}
+
+	aggregate_flush(time(NULL), 1);
+	stats_socket(worker, 0);
+
+	return NULL;
+}
+
+static int log_level(const char *level)
+{
+	int i;
+
+	for (i = 0; prioritynames[i].c_name; i++) {
+		if (!strcmp(prioritynames[i].c_name, level))
+			return prioritynames[i].c_val;
+	}
+
+	return -1;
+}
+
 static char *progname(char *arg0)
 {
        char *nm;
@@ -308,32 +1080,42 @@ static char *progname(char *arg0)
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "hi:p:P:u:vI:46";
+	static const char short_options[] = "a:b:B:c:C:E:hi:l:p:P:q:r:R:s:S:Tu:vw:y:I:46";
 	static const struct option long_options[] = {
 		{ "use-ipv4",    0, 0, '4' },
 		{ "use-ipv6",    0, 0, '6' },
+		{ "aggregate",   1, 0, 'a' },
+		{ "batch",       1, 0, 'b' },
+		{ "burst",       1, 0, 'B' },
+		{ "max-clients", 1, 0, 'c' },
+		{ "cpus",        1, 0, 'C' },
+		{ "engine",      1, 0, 'E' },
 		{ "help",        0, 0, 'h' },
 		{ "interfaces",  1, 0, 'i' },
 		{ "listen",      1, 0, 'I' },
+		{ "log-level",   1, 0, 'l' },
 		{ "udp-port",    1, 0, 'p' },
 		{ "tcp-port",    1, 0, 'P' },
+		{ "queue",       1, 0, 'q' },
+		{ "read-pcap",   1, 0, 'r' },
+		{ "rate-limit",  1, 0, 'R' },
+		{ "sniff",       1, 0, 's' },
+		{ "summary",     1, 0, 'S' },
+		{ "transparent", 0, 0, 'T' },
 		{ "drop-privs",  1, 0, 'u' },
 		{ "version",     0, 0, 'v' },
+		{ "workers",     1, 0, 'w' },
+		{ "busy-poll",   1, 0, 'y' },
 		{ NULL, 0, 0, 0 }
 	};
-	int ticks, nfds, c, option_index = 1;
+	int c, option_index = 1;
+	char *cpu_list[MAX_NR_WORKERS];
 	size_t i;
-	fd_set rfds, wfds;
+	rlim_t nfiles;
+	struct rlimit rlim;
 	struct sigaction sig;
-	struct ifreq ifreq;
-	struct timeval tv_last;
-	struct timeval tv_now;
-	struct timeval tv_sleep;
-	my_socklen_t socklen;
-	union {
-		struct sockaddr_in sa;
-		struct sockaddr_in6 sa6;
-	} sockaddr;
+	sigset_t sigset;
+	uint64_t rate_limited = 0, kernel_dropped = 0, overflows;
 #ifdef HAVE_LIBCONFUSE
 	char path[256] = "";
 	char *config = NULL;
@@ -355,6 +1137,66 @@ int main(int argc, char *argv[])
 		case '6':
 			g_family = AF_INET6;
 			break;
+
+		case 'a':
+			g_aggregate_size = atoi(optarg);
+			if (g_aggregate_size > MAX_NR_AGGREGATES) {
+				fprintf(stderr, "Invalid number of aggregates, must be 0..%d\n", MAX_NR_AGGREGATES);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'b':
+			g_udp_batch = atoi(optarg);
+			if (g_udp_batch < 1 || g_udp_batch > MAX_UDP_BATCH) {
+				fprintf(stderr, "Invalid batch size, must be 1..%d\n", MAX_UDP_BATCH);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'B':
+			g_rate_burst = atoi(optarg);
+			if (g_rate_burst < 1 || g_rate_burst > MAX_RATE_BURST) {
+				fprintf(stderr, "Invalid burst, must be 1..%d\n", MAX_RATE_BURST);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'c':
+			g_max_clients = atoi(optarg);
+			if (g_max_clients < 1 || g_max_clients > MAX_NR_CLIENTS) {
+				fprintf(stderr, "Invalid number of clients, must be 1..%d\n", MAX_NR_CLIENTS);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'C':
+			g_cpu_list_length = split(optarg, ",", cpu_list, MAX_NR_WORKERS);
+			if (!g_cpu_list_length) {
+				fprintf(stderr, "Invalid CPU list %s\n", optarg);
+				return usage(EXIT_ARGS);
+			}
+			for (i = 0; i < g_cpu_list_length; i++) {
+				g_cpu_list[i] = atoi(cpu_list[i]);
+				if (cpu_list[i][strspn(cpu_list[i], "0123456789")] || g_cpu_list[i] >= CPU_SETSIZE) {
+					fprintf(stderr, "Invalid CPU %s, must be 0..%d\n", cpu_list[i], CPU_SETSIZE - 1);
+					return usage(EXIT_ARGS);
+				}
+				free(cpu_list[i]);
+			}
+			break;
+
+		case 'E':
+			if (!strcmp(optarg, "epoll")) {
+				g_engine = ENGINE_EPOLL;
+			} else if (!strcmp(optarg, "io_uring") || !strcmp(optarg, "uring")) {
+				g_engine = ENGINE_URING;
+			} else {
+				fprintf(stderr, "Unknown engine %s, must be epoll or io_uring\n", optarg);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
 		case 'h':
 			return usage(0);
 
@@ -366,6 +1208,14 @@ int main(int argc, char *argv[])
 			g_bind_to_device = strdup(optarg);
 			break;
 #endif
+		case 'l':
+			g_level = log_level(optarg);
+			if (g_level < 0) {
+				fprintf(stderr, "Unknown log level %s\n", optarg);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
 		case 'p':
 			g_udp_port = atoi(optarg);
 			break;
@@ -374,6 +1224,42 @@ int main(int argc, char *argv[])
 			g_tcp_port = atoi(optarg);
 			break;
 
+		case 'q':
+			g_udp_queue = atoi(optarg);
+			if (g_udp_queue < 1 || g_udp_queue > MAX_UDP_QUEUE) {
+				fprintf(stderr, "Invalid queue length, must be 1..%d\n", MAX_UDP_QUEUE);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'r':
+			g_read_pcap = optarg;
+			break;
+
+		case 'R':
+			g_rate_limit = atoi(optarg);
+			if (g_rate_limit < 1 || g_rate_limit > MAX_RATE_LIMIT) {
+				fprintf(stderr, "Invalid rate limit, must be 1..%d\n", MAX_RATE_LIMIT);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 's':
+			g_sniff_device = optarg;
+			break;
+
+		case 'S':
+			g_summary_interval = atoi(optarg);
+			if (g_summary_interval < 1) {
+				fprintf(stderr, "Invalid summary interval, must be at least 1 second\n");
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'T':
+			g_transparent = 1;
+			break;
+
 		case 'u':
 			g_user = optarg;
 			break;
@@ -382,6 +1268,22 @@ int main(int argc, char *argv[])
 			printf("v" PACKAGE_VERSION "\n");
 			return 0;
 
+		case 'w':
+			g_worker_list_length = atoi(optarg);
+			if (g_worker_list_length < 1 || g_worker_list_length > MAX_NR_WORKERS) {
+				fprintf(stderr, "Invalid number of workers, must be 1..%d\n", MAX_NR_WORKERS);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'y':
+			g_busy_poll = atoi(optarg);
+			if (g_busy_poll < 0 || g_busy_poll > MAX_BUSY_POLL) {
+				fprintf(stderr, "Invalid busy poll time, must be 0..%d us\n", MAX_BUSY_POLL);
+				return usage(EXIT_ARGS);
+			}
+			break;
+
 
 		default:
 			return usage(EXIT_ARGS);
@@ -392,17 +1294,26 @@ int main(int argc, char *argv[])
 		g_udp_port = 161;		/* standard port, but don't override the user */
 	if (!g_tcp_port)
 		g_tcp_port = g_udp_port;	/* don't override if it's already set */
+	if (!g_rate_burst)
+		g_rate_burst = g_rate_limit;
 
 	logit(LOG_NOTICE, 0, PROGRAM_IDENT " starting");
+	log_start(g_read_pcap != NULL);
 	g_timeout *= 100;
 
-	/* Store the starting time since we need it for MIB updates */
-	if (gettimeofday(&tv_last, NULL) == -1) {
-		memset(&tv_last, 0, sizeof(tv_last));
-		memset(&tv_sleep, 0, sizeof(tv_sleep));
-	} else {
-		tv_sleep.tv_sec = g_timeout / 100;
-		tv_sleep.tv_usec = (g_timeout % 100) * 10000;
+	/* Make sure we can hold the TCP clients plus our own descriptors */
+	nfiles = g_worker_list_length * (g_max_clients + 3) + 16;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur < nfiles) {
+		rlim_t hard = rlim.rlim_max;
+
+		rlim.rlim_cur = nfiles;
+		if (rlim.rlim_max < rlim.rlim_cur)
+			rlim.rlim_max = rlim.rlim_cur;
+		if (setrlimit(RLIMIT_NOFILE, &rlim) == -1) {
+			logit(LOG_WARNING, errno, "could not raise open file limit for %zu clients", g_max_clients);
+			rlim.rlim_cur = rlim.rlim_max = hard;
+			setrlimit(RLIMIT_NOFILE, &rlim);
+		}
 	}
 
 	/* Prevent TERM and HUP signals from interrupting system calls */
@@ -412,86 +1323,39 @@ int main(int argc, char *argv[])
 	sigaction(SIGTERM, &sig, NULL);
 	sigaction(SIGINT, &sig, NULL);
 	sigaction(SIGHUP, &sig, NULL);
+	sig.sa_handler = handle_dump_signal;
+	sigaction(SIGUSR1, &sig, NULL);
 
-	/* Open the server's UDP port and prepare it for listening */
-	g_udp_sockfd = socket((g_family == AF_INET) ? PF_INET : PF_INET6, SOCK_DGRAM, 0);
-	if (g_udp_sockfd == -1) {
-		logit(LOG_ERR, errno, "could not create UDP socket");
-		exit(EXIT_SYSCALL);
-	}
-
-	if (g_family == AF_INET) {
-		sockaddr.sa.sin_family = g_family;
-		sockaddr.sa.sin_port = htons(g_udp_port);
-		sockaddr.sa.sin_addr = inaddr_any;
-		socklen = sizeof(sockaddr.sa);
-	} else {
-		sockaddr.sa6.sin6_family = g_family;
-		sockaddr.sa6.sin6_port = htons(g_udp_port);
-		sockaddr.sa6.sin6_addr = in6addr_any;
-		socklen = sizeof(sockaddr.sa6);
-	}
-	if (bind(g_udp_sockfd, (struct sockaddr *)&sockaddr, socklen) == -1) {
-		logit(LOG_ERR, errno, "could not bind UDP socket to port %d", g_udp_port);
-		exit(EXIT_SYSCALL);
-	}
-
-#ifndef __FreeBSD__
-	if (g_bind_to_device) {
-		snprintf(ifreq.ifr_ifrn.ifrn_name, sizeof(ifreq.ifr_ifrn.ifrn_name), "%s", g_bind_to_device);
-		if (setsockopt(g_udp_sockfd, SOL_SOCKET, SO_BINDTODEVICE, (char *)&ifreq, sizeof(ifreq)) == -1) {
-			logit(LOG_WARNING, errno, "could not bind UDP socket to device %s", g_bind_to_device);
-			exit(EXIT_SYSCALL);
-		}
-	}
-#endif
-
-	/* Open the server's TCP port and prepare it for listening */
-	g_tcp_sockfd = socket((g_family == AF_INET) ? PF_INET : PF_INET6, SOCK_STREAM, 0);
-	if (g_tcp_sockfd == -1) {
-		logit(LOG_ERR, errno, "could not create TCP socket");
+	/* A block of counters per worker, or for the one thread reading packets */
+	if (stats_open(g_read_pcap || g_sniff_device ? 1 : g_worker_list_length) == -1) {
+		logit(LOG_ERR, ENOMEM, "could not allocate statistics");
 		exit(EXIT_SYSCALL);
 	}
-
-#ifndef __FreeBSD__
-	if (g_bind_to_device) {
-		snprintf(ifreq.ifr_ifrn.ifrn_name, sizeof(ifreq.ifr_ifrn.ifrn_name), "%s", g_bind_to_device);
-		if (setsockopt(g_tcp_sockfd, SOL_SOCKET, SO_BINDTODEVICE, (char *)&ifreq, sizeof(ifreq)) == -1) {
-			logit(LOG_WARNING, errno, "could not bind TCP socket to device %s", g_bind_to_device);
-			exit(EXIT_SYSCALL);
-		}
-	}
-#endif
-
-	c = 1;
-	if (setsockopt(g_tcp_sockfd, SOL_SOCKET, SO_REUSEADDR, &c, sizeof(c)) == -1) {
-		logit(LOG_WARNING, errno, "could not set SO_REUSEADDR on TCP socket");
+	if (latency_open(g_read_pcap || g_sniff_device ? 1 : g_worker_list_length) == -1) {
+		logit(LOG_ERR, ENOMEM, "could not allocate latency histograms");
 		exit(EXIT_SYSCALL);
 	}
 
-	if (g_family == AF_INET) {
-		sockaddr.sa.sin_family = g_family;
-		sockaddr.sa.sin_port = htons(g_udp_port);
-		sockaddr.sa.sin_addr = inaddr_any;
-		socklen = sizeof(sockaddr.sa);
+	/* Open the sockets of all workers before dropping privileges */
+	if (g_read_pcap) {
+		pcap_file_open(g_read_pcap);
+	} else if (g_sniff_device) {
+		capture_open(g_sniff_device);
 	} else {
-		sockaddr.sa6.sin6_family = g_family;
-		sockaddr.sa6.sin6_port = htons(g_udp_port);
-		sockaddr.sa6.sin6_addr = in6addr_any;
-		socklen = sizeof(sockaddr.sa6);
-	}
-	if (bind(g_tcp_sockfd, (struct sockaddr *)&sockaddr, socklen) == -1) {
-		logit(LOG_ERR, errno, "could not bind TCP socket to port %d", g_tcp_port);
-		exit(EXIT_SYSCALL);
-	}
+		g_worker_list = allocate(g_worker_list_length * sizeof(worker_t));
+		if (!g_worker_list)
+			exit(EXIT_SYSCALL);
 
-	if (listen(g_tcp_sockfd, 128) == -1) {
-		logit(LOG_ERR, errno, "could not prepare TCP socket for listening");
-		exit(EXIT_SYSCALL);
+		for (i = 0; i < g_worker_list_length; i++)
+			open_worker(&g_worker_list[i], i);
 	}
 
 	/* Print a starting message (so the user knows the args were ok) */
-	if (g_bind_to_device)
+	if (g_read_pcap)
+		logit(LOG_NOTICE, 0, "Reading requests to port %d/udp from %s", g_udp_port, g_read_pcap);
+	else if (g_sniff_device)
+		logit(LOG_NOTICE, 0, "Sniffing for port %d/udp on interface %s", g_udp_port, g_sniff_device);
+	else if (g_bind_to_device)
 		logit(LOG_NOTICE, 0, "Listening on port %d/udp and %d/tcp on interface %s",
 		      g_udp_port, g_tcp_port, g_bind_to_device);
 	else
@@ -530,80 +1394,68 @@ int main(int argc, char *argv[])
 		logit(LOG_NOTICE, 0, "Successfully dropped privileges to %s:%s", pwd->pw_name, grp->gr_name);
 	}
 
-	/* Handle incoming connect requests and incoming data */
-	while (!g_quit) {
-		/* Sleep until we get a request or the timeout is over */
-		FD_ZERO(&rfds);
-		FD_ZERO(&wfds);
-		FD_SET(g_udp_sockfd, &rfds);
-		FD_SET(g_tcp_sockfd, &rfds);
-		nfds = (g_udp_sockfd > g_tcp_sockfd) ? g_udp_sockfd : g_tcp_sockfd;
-
-		for (i = 0; i < g_tcp_client_list_length; i++) {
-			if (g_tcp_client_list[i]->outgoing)
-				FD_SET(g_tcp_client_list[i]->sockfd, &wfds);
-			else
-				FD_SET(g_tcp_client_list[i]->sockfd, &rfds);
-
-			if (nfds < g_tcp_client_list[i]->sockfd)
-				nfds = g_tcp_client_list[i]->sockfd;
-		}
-
-		if (select(nfds + 1, &rfds, &wfds, NULL, &tv_sleep) == -1) {
-			if (g_quit)
-				break;
+	if (g_read_pcap || g_sniff_device) {
+		pin_thread(0);
+		stats_thread(0);
+		latency_thread(0);
+		if (g_read_pcap)
+			run_pcap_file();
+		else
+			run_capture();
+		latency_dump();
+		logit(LOG_NOTICE, 0, PROGRAM_IDENT " stopping");
+		return EXIT_OK;
+	}
 
-			logit(LOG_ERR, errno, "could not select from sockets");
+	/*
+	 * Worker 0 runs on the main thread, the others get their own with
+	 * our signals blocked, as the log writer has them, so only the main
+	 * thread is ever interrupted.
+	 * They notice g_quit on their next wakeup, at most g_timeout later.
+	 */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGHUP);
+	sigaddset(&sigset, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+	for (i = 1; i < g_worker_list_length; i++) {
+		c = pthread_create(&g_worker_list[i].thread, NULL,
+				   g_engine == ENGINE_URING ? run_uring_worker : run_worker, &g_worker_list[i]);
+		if (c) {
+			logit(LOG_ERR, c, "could not start worker %zu", i);
 			exit(EXIT_SYSCALL);
 		}
+	}
+	pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
 
-		/* Determine whether to update the MIB and the next ticks to sleep */
-		ticks = ticks_since(&tv_last, &tv_now);
-		if (ticks < 0 || ticks >= g_timeout) {
-			memcpy(&tv_last, &tv_now, sizeof(tv_now));
-			tv_sleep.tv_sec = g_timeout / 100;
-			tv_sleep.tv_usec = (g_timeout % 100) * 10000;
-		} else {
-			tv_sleep.tv_sec = (g_timeout - ticks) / 100;
-			tv_sleep.tv_usec = ((g_timeout - ticks) % 100) * 10000;
-		}
-
-		/* Handle UDP packets, TCP packets and TCP connection connects */
-		if (FD_ISSET(g_udp_sockfd, &rfds))
-			handle_udp_client();
+	if (g_worker_list_length > 1)
+		logit(LOG_NOTICE, 0, "Started %zu workers", g_worker_list_length);
 
-		if (FD_ISSET(g_tcp_sockfd, &rfds))
-			handle_tcp_connect();
+	if (g_engine == ENGINE_URING)
+		run_uring_worker(&g_worker_list[0]);
+	else
+		run_worker(&g_worker_list[0]);
 
-		for (i = 0; i < g_tcp_client_list_length; i++) {
-			if (g_tcp_client_list[i]->outgoing) {
-				if (FD_ISSET(g_tcp_client_list[i]->sockfd, &wfds))
-					handle_tcp_client_write(g_tcp_client_list[i]);
-			} else {
-				if (FD_ISSET(g_tcp_client_list[i]->sockfd, &rfds))
-					handle_tcp_client_read(g_tcp_client_list[i]);
-			}
-		}
+	for (i = 1; i < g_worker_list_length; i++)
+		pthread_join(g_worker_list[i].thread, NULL);
 
-		/* If there was a TCP disconnect, remove the client from the list */
-		for (i = 0; i < g_tcp_client_list_length; i++) {
-			if (g_tcp_client_list[i]->sockfd == -1) {
-				g_tcp_client_list_length--;
-				if (i < g_tcp_client_list_length) {
-					size_t len = (g_tcp_client_list_length - i) * sizeof(g_tcp_client_list[i]);
-
-					free(g_tcp_client_list[i]);
-					memmove(&g_tcp_client_list[i], &g_tcp_client_list[i + 1], len);
-
-					/*
-					 * list changed, there could be more than
-					 * one to remove, start from begining
-					 */
-					i = -1;
-				}
-			}
-		}
+	for (i = 0; i < g_stats_segment->nr_threads; i++) {
+		rate_limited += g_stats_segment->thread_list[i].rate_limited;
+		kernel_dropped += g_stats_segment->thread_list[i].kernel_dropped;
 	}
+	if (g_rate_limit)
+		logit(LOG_NOTICE, 0, "Dropped %llu UDP requests over the rate limit", (unsigned long long)rate_limited);
+	if (kernel_dropped)
+		logit(LOG_NOTICE, 0, "Kernel dropped %llu UDP datagrams, filtered out or over the socket buffer",
+		      (unsigned long long)kernel_dropped);
+
+	/* Counted for the namespace, so these may include other sockets' */
+	overflows = g_stats_segment->thread_list[0].buffer_overflows;
+	if (overflows)
+		logit(LOG_NOTICE, 0, "UDP socket buffers of this network namespace overflowed %llu times",
+		      (unsigned long long)overflows);
+	latency_dump();
 
 	/* We were signaled, print a message and exit */
 	logit(LOG_NOTICE, 0, PROGRAM_IDENT " stopping");
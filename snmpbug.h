@@ -20,7 +20,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include <netinet/in.h>
 
 #include "config.h"
@@ -43,12 +46,30 @@
 #define EXIT_ARGS                                       1
 #define EXIT_SYSCALL                                    2
 
-#define MAX_NR_CLIENTS                                  16
-#define MAX_NR_OIDS                                     20
-#define MAX_NR_SUBIDS                                   20
+#define MAX_NR_CLIENTS                                  65536
+#define DEFAULT_NR_CLIENTS                              16
+#define MAX_NR_VARBINDS                                 (MAX_PACKET_SIZE / 7)	/* 30 05 06 01 xx 05 00 */
+#define MAX_NR_SUBIDS                                   MAX_PACKET_SIZE		/* At least a byte each */
 #define MAX_NR_DISKS                                    4
 #define MAX_NR_INTERFACES                               8
-#define MAX_NR_VALUES                                   2048
+#define MAX_UDP_BATCH                                   256
+#define DEFAULT_UDP_BATCH                               32
+#define UDP_CONTROL_SIZE                                128	/* Ancillary data received per datagram */
+#define UDP_TRUESIZE                                    2048	/* Kernel memory a queued request takes, at most */
+#define MAX_UDP_BUFFER                                  (64 << 20)
+#define MAX_UDP_QUEUE                                   (MAX_UDP_BUFFER / UDP_TRUESIZE)
+#define UDP_OVERFLOWS_UNKNOWN                           UINT64_MAX	/* Neither /proc/net/snmp nor snmp6 readable */
+#define MAX_NR_EVENTS                                   256
+#define MAX_NR_WORKERS                                  64
+#define MAX_NR_AGGREGATES                               (1 << 24)
+#define DEFAULT_NR_AGGREGATES                           16384
+#define DEFAULT_SUMMARY_INTERVAL                        60
+#define MAX_RATE_LIMIT                                  1000000
+#define MAX_RATE_BURST                                  1000000
+#define MAX_BUSY_POLL                                   100000	/* us */
+
+#define ENGINE_EPOLL                                    0
+#define ENGINE_URING                                    1
 
 #define MAX_PACKET_SIZE                                 2048
 #define MAX_STRING_SIZE                                 64
@@ -107,6 +128,39 @@
 
 #define PROGRAM_IDENT PACKAGE_NAME " v" PACKAGE_VERSION
 
+#define STATS_NAME                                      "/snmpbug.%d"	/* By UDP port */
+#define STATS_MAGIC                                     0x534E4D50	/* "SNMP" */
+#define STATS_VERSION                                   3
+
+#define STATS_DECODE_HEADER                             0
+#define STATS_DECODE_VERSION                            1
+#define STATS_DECODE_COMMUNITY                          2
+#define STATS_DECODE_PDU                                3
+#define STATS_DECODE_VARBINDS                           4
+#define STATS_NR_DECODE                                 5
+
+#define STATS_TYPE_GET                                  0
+#define STATS_TYPE_GETNEXT                              1
+#define STATS_TYPE_GETBULK                              2
+#define STATS_TYPE_SET                                  3
+#define STATS_TYPE_OTHER                                4
+#define STATS_NR_TYPES                                  5
+
+#define LATENCY_QUEUE                                   0	/* Arrival until received, in ns */
+#define LATENCY_RECV                                    1	/* recvmmsg(), per batch */
+#define LATENCY_DECODE                                  2
+#define LATENCY_LOG                                     3
+#define LATENCY_HANDLE                                  4
+#define LATENCY_ENCODE                                  5
+#define LATENCY_SEND                                    6	/* sendmmsg(), per batch */
+#define LATENCY_RESPONSE                                7	/* Arrival until the reply is sent, in ns */
+#define LATENCY_NR_PHASES                               8
+
+#define LATENCY_SUB_BITS                                5	/* 32 buckets per power of 2, within 3% */
+#define LATENCY_MAX_BITS                                40	/* Longer is counted as the longest */
+#define LATENCY_SAMPLE                                  8	/* Time one in this many requests, power of 2 */
+#define LATENCY_NR_BUCKETS                              ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
 #define my_sockaddr_t           struct sockaddr_in6
 #define my_socklen_t            socklen_t
 #define my_sin_addr             sin6_addr
@@ -125,14 +179,89 @@
 
 typedef struct client_s {
 	time_t              timestamp;
+	long                timestamp_nsec;	/* When it arrived, -1 if only the second is known */
 	int                 sockfd;
 	my_in_addr_t        addr;
 	my_in_port_t        port;
+	my_in_addr_t        local_addr;		/* Address it was sent to, :: if not known */
+	my_in_addr_t        reply_addr;		/* Address to answer from, :: to leave it to routing */
+	int                 reply_ifindex;
 	unsigned char       packet[MAX_PACKET_SIZE];
 	size_t              size;
 	int                 outgoing;
+	size_t              index;		/* Position in tcp_client_list */
+	unsigned long       serial;		/* Order of TCP connects, breaks timestamp ties */
 } client_t;
 
+/*
+ * Each worker owns its sockets (bound with SO_REUSEPORT when there are
+ * several of them), its event loop and all client state, so the packet
+ * path never has to share anything between threads.
+ */
+struct uring_s;
+
+typedef struct worker_s {
+	pthread_t           thread;
+	int                 id;
+	int                 udp_sockfd;
+	int                 tcp_sockfd;
+	int                 epoll_fd;
+	struct uring_s     *uring;
+	client_t            udp_client_list[MAX_UDP_BATCH];
+	client_t          **tcp_client_list;
+	size_t              tcp_client_list_length;
+	unsigned long       tcp_client_serial;
+	int                 udp_rcvbuf;		/* Socket buffer sizes, as the kernel reports them */
+	int                 udp_sndbuf;
+	uint32_t            udp_dropped;	/* Last SO_RXQ_OVFL count seen */
+	uint64_t            udp_overflows;	/* stats_udp_overflows() of the last stats_socket() */
+	uint64_t            udp_overflows_grown;	/* The same when the receive buffer was last grown */
+	time_t              udp_grown;		/* When a buffer was last grown, or found not to need it */
+} worker_t;
+
+/*
+ * Counters of one thread, in the shared memory segment snmpbug-top maps.
+ * Only the owning thread writes them, with relaxed stores, and each block
+ * has cache lines of its own.
+ */
+typedef struct stats_s {
+	uint64_t            packets_in;
+	uint64_t            packets_out;
+	uint64_t            bytes_in;
+	uint64_t            bytes_out;
+	uint64_t            decode_errors[STATS_NR_DECODE];
+	uint64_t            requests[STATS_NR_TYPES];
+	uint64_t            versions[2];	/* v1, v2c */
+	uint64_t            tcp_accepts;
+	uint64_t            tcp_evictions;
+	uint64_t            rate_limited;
+	uint64_t            log_dropped;
+	uint64_t            kernel_dropped;	/* By the socket filter or a full queue */
+	uint64_t            buffer_overflows;	/* Of any UDP socket in the namespace, first thread only */
+} __attribute__((aligned(64))) stats_t;
+
+typedef struct stats_segment_s {
+	uint32_t            magic;
+	uint32_t            version;
+	uint32_t            stats_size;		/* sizeof(stats_t) */
+	uint32_t            nr_threads;
+	int64_t             pid;
+	int64_t             started;
+	stats_t             thread_list[] __attribute__((aligned(64)));
+} stats_segment_t;
+
+/*
+ * Log-linear histograms of how long each phase of a request took, in
+ * clock ticks, one set per thread.  Compiled out with -DNO_LATENCY.
+ */
+typedef struct latency_s {
+	uint64_t            bucket_list[LATENCY_NR_PHASES][LATENCY_NR_BUCKETS];
+	unsigned            nr_requests;	/* Picks the ones to time */
+} latency_t;
+
+#define STATS_INC(field)	STATS_ADD(field, 1)
+#define STATS_ADD(field, n)	__atomic_store_n(&g_stats->field, g_stats->field + (n), __ATOMIC_RELAXED)
+
 typedef struct oid_s {
 	unsigned int subid_list[MAX_NR_SUBIDS];
 	size_t       subid_list_length;
@@ -145,8 +274,14 @@ typedef struct data_s {
 	short          encoded_length;
 } data_t;
 
+/* Where a BER element (type, length and value) is found in the packet */
+typedef struct view_s {
+	size_t pos;
+	size_t len;
+} view_t;
+
 typedef struct value_s {
-	oid_t  oid;
+	view_t oid;		/* In the request packet */
 	data_t data;
 } value_t;
 
@@ -157,6 +292,12 @@ typedef struct field_s {
 	long long    *value[24];
 } field_t;
 
+typedef struct varbind_s {
+	view_t varbind;		/* As far as its sequence header claims */
+	view_t oid;
+	view_t value;
+} varbind_t;
+
 typedef struct request_s {
 	char      community[MAX_STRING_SIZE];
 	int       type;
@@ -164,15 +305,20 @@ typedef struct request_s {
 	int       id;
 	uint32_t  non_repeaters;
 	uint32_t  max_repetitions;
-	oid_t     oid_list[MAX_NR_OIDS];
-	size_t    oid_list_length;
+
+	view_t    community_view;
+	view_t    id_view;
+	view_t    error_view[2];
+	varbind_t varbind_list[MAX_NR_VARBINDS];
+	size_t    varbind_list_length;
 } request_t;
 
 typedef struct response_s {
-	int     error_status;
-	int     error_index;
-	value_t value_list[MAX_NR_VALUES];
-	size_t  value_list_length;
+	int      error_status;
+	int      error_index;
+	value_t *value_list;		/* Scratch space, one value per request varbind */
+	size_t   value_list_size;
+	size_t   value_list_length;
 } response_t;
 
 
@@ -187,35 +333,178 @@ extern int       g_family;
 extern int       g_timeout;
 extern int       g_auth;
 extern int       g_level;
+extern int       g_engine;
+extern int       g_transparent;
 extern volatile sig_atomic_t g_quit;
 
 extern char     *g_prognm;
 extern char     *g_bind_to_device;
+extern char     *g_sniff_device;
+extern char     *g_read_pcap;
 extern char     *g_user;
 
 extern char     *g_interface_list[MAX_NR_INTERFACES];
 extern size_t    g_interface_list_length;
 
-extern client_t  g_udp_client;
-extern client_t *g_tcp_client_list[MAX_NR_CLIENTS];
-extern size_t    g_tcp_client_list_length;
+extern in_port_t g_udp_port;
+extern in_port_t g_tcp_port;
+
+extern size_t    g_udp_batch;
+extern size_t    g_udp_queue;
+extern size_t    g_max_clients;
+
+extern size_t    g_aggregate_size;
+extern int       g_summary_interval;
+
+extern uint32_t  g_rate_limit;
+extern uint32_t  g_rate_burst;
+
+extern int       g_busy_poll;
+extern int       g_cpu_list[MAX_NR_WORKERS];
+extern size_t    g_cpu_list_length;
 
-extern int       g_udp_sockfd;
-extern int       g_tcp_sockfd;
+extern worker_t *g_worker_list;
+extern size_t    g_worker_list_length;
+
+extern stats_segment_t *g_stats_segment;
+extern __thread stats_t *g_stats;
+
+extern volatile sig_atomic_t g_latency_dump;
+extern __thread latency_t *g_latency;
 
 /*
  * Functions
  */
 
 int	split(const char *str, char *delim, char **list, int max_list_length);
-client_t *find_oldest_client(void);
+client_t *find_oldest_client(const worker_t *worker);
 void	*allocate(size_t len);
+size_t	hexdump(char *buf, size_t size, const unsigned char *data, size_t len);
 
 int	ticks_since (const struct timeval *tv_last, struct timeval *tv_now);
 int	logit(int priority, int syserr, const char *fmt, ...);
+int	log_start(int wait);
+void	log_stop(void);
 
 int	snmp_packet_complete(const client_t *client);
 int 	snmp(client_t *client);
+int	snmp_sniff(const client_t *client);
+
+int	stats_open(size_t nr_threads);
+void	stats_thread(size_t id);
+void	stats_socket(worker_t *worker, time_t now);
+uint64_t stats_udp_overflows(void);
+
+#ifdef NO_LATENCY
+#define latency_open(nr_threads)	0
+#define latency_thread(id)		do { } while (0)
+#define latency_poll()			do { } while (0)
+#define latency_dump()			do { } while (0)
+#else
+int	latency_open(size_t nr_threads);
+void	latency_thread(size_t id);
+void	latency_poll(void);
+void	latency_dump(void);
+#endif
+
+uint32_t ratelimit_clock(void);
+int	ratelimit(const my_in_addr_t *addr, uint32_t now);
+
+int	aggregate_request(const request_t *request, const client_t *client);
+void	aggregate_flush(time_t now, int all);
+
+void	remove_tcp_client(worker_t *worker, client_t *client);
+client_t *evict_tcp_client(worker_t *worker);
+client_t *add_tcp_client(worker_t *worker, int sockfd, const my_sockaddr_t *sockaddr);
+int	handle_udp_request(client_t *client);
+void	handle_udp_control(worker_t *worker, client_t *client, struct msghdr *msg);
+void	handle_udp_source(const client_t *client, struct msghdr *msg, char *control);
+void	grow_udp_buffer(worker_t *worker, int optname);
+void	handle_tcp_client_sent(client_t *client, ssize_t rv);
+void	handle_tcp_client_received(client_t *client, ssize_t rv);
+void	pin_thread(size_t id);
+
+int	uring_open(worker_t *worker);
+void	*run_uring_worker(void *arg);
+
+int	capture_parse_ip(const unsigned char *ip, size_t len, client_t *client);
+int	capture_parse_frame(const unsigned char *frame, size_t len, client_t *client);
+int	capture_open(const char *ifname);
+void	run_capture(void);
+
+int	pcap_file_open(const char *file);
+void	run_pcap_file(void);
+
+/*
+ * Phases are timed by chaining stamps: LATENCY_STAMP(t) starts the clock,
+ * every LATENCY_PHASE(phase, t) charges the time since to phase and
+ * restarts it.  Reading the clock costs about as much as a phase of a
+ * small request, so LATENCY_SAMPLE(t) only starts it for one request in
+ * LATENCY_SAMPLE and leaves t 0 for the others, which are not timed.
+ *
+ * LATENCY_ARRIVAL(phase, client, now) charges the time from when the
+ * kernel received a datagram to now, read with LATENCY_REALTIME(now).
+ */
+#ifdef NO_LATENCY
+#define LATENCY_STAMP(t)		((void)(t))
+#define LATENCY_SAMPLE_STAMP(t)		((void)(t))
+#define LATENCY_PHASE(phase, t)		((void)(t))
+#define LATENCY_REALTIME(now)		((void)(now))
+#define LATENCY_ARRIVAL(phase, client, now)	do { } while (0)
+#else
+#define LATENCY_STAMP(t)		((t) = latency_clock())
+#define LATENCY_SAMPLE_STAMP(t)		((t) = g_latency->nr_requests++ & (LATENCY_SAMPLE - 1) ? 0 : latency_clock())
+#define LATENCY_PHASE(phase, t)		do { if (t) latency_record(phase, &(t)); } while (0)
+#define LATENCY_REALTIME(now)		clock_gettime(CLOCK_REALTIME, &(now))
+#define LATENCY_ARRIVAL(phase, client, now)	latency_arrival(phase, client, &(now))
+
+static inline uint64_t latency_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void latency_add(int phase, uint64_t value)
+{
+	uint64_t *bucket;
+	int shift;
+
+	if (value >> LATENCY_MAX_BITS)
+		value = (1ULL << LATENCY_MAX_BITS) - 1;
+	bucket = g_latency->bucket_list[phase];
+	if (value >> LATENCY_SUB_BITS) {
+		shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BITS;
+		bucket += ((shift + 1) << LATENCY_SUB_BITS) + (value >> shift) - (1 << LATENCY_SUB_BITS);
+	} else {
+		bucket += value;
+	}
+	__atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+}
+
+static inline void latency_record(int phase, uint64_t *stamp)
+{
+	uint64_t now = latency_clock();
+
+	latency_add(phase, now - *stamp);
+	*stamp = now;
+}
+
+static inline void latency_arrival(int phase, const client_t *client, const struct timespec *now)
+{
+	int64_t ns;
+
+	if (client->timestamp_nsec < 0)
+		return;
+	ns = (int64_t)(now->tv_sec - client->timestamp) * 1000000000 + now->tv_nsec - client->timestamp_nsec;
+	latency_add(phase, ns > 0 ? ns : 0);
+}
+#endif
 
 #ifndef HAVE_GETPROGNAME
 static inline char *getprogname(void)
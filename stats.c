@@ -0,0 +1,174 @@
+/* Live statistics
+ *
+ * The counters of every thread live in a shared memory segment named
+ * after the UDP port, which snmpbug-top maps read-only.  Each thread
+ * only ever writes its own block with plain relaxed stores, so reading
+ * them costs the packet path nothing: no locks, no system calls.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/sock_diag.h>
+#endif
+
+#include "snmpbug.h"
+
+static char   stats_name[32];
+static __thread time_t stats_socket_time;
+static uint64_t stats_overflows_start;
+
+static void stats_close(void)
+{
+	/* May fail after dropping privileges, the next start truncates it */
+	shm_unlink(stats_name);
+}
+
+int stats_open(size_t nr_threads)
+{
+	stats_segment_t *segment = MAP_FAILED;
+	size_t stats_size;
+	int fd;
+
+	snprintf(stats_name, sizeof(stats_name), STATS_NAME, g_udp_port);
+	stats_size = sizeof(stats_segment_t) + nr_threads * sizeof(stats_t);
+
+	fd = shm_open(stats_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		if (ftruncate(fd, stats_size) == 0)
+			segment = mmap(NULL, stats_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+
+	/* Still count, just without anybody able to look */
+	if (segment == MAP_FAILED) {
+		logit(LOG_WARNING, errno, "could not create statistics segment %s", stats_name);
+		shm_unlink(stats_name);
+		if (posix_memalign((void **)&segment, 64, stats_size))
+			return -1;
+		memset(segment, 0, stats_size);
+	} else {
+		atexit(stats_close);
+	}
+
+	segment->version = STATS_VERSION;
+	segment->stats_size = sizeof(stats_t);
+	segment->nr_threads = nr_threads;
+	segment->pid = getpid();
+	segment->started = time(NULL);
+	stats_overflows_start = stats_udp_overflows();
+	__atomic_store_n(&segment->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+	g_stats_segment = segment;
+
+	return 0;
+}
+
+/* Have the calling thread count in block id from now on */
+void stats_thread(size_t id)
+{
+	if (g_stats_segment && id < g_stats_segment->nr_threads)
+		g_stats = &g_stats_segment->thread_list[id];
+}
+
+/*
+ * UDP datagrams the kernel dropped for lack of room in a socket buffer,
+ * RcvbufErrors of /proc/net/snmp and /proc/net/snmp6.  Unlike the drops
+ * of a socket these leave out what a socket filter rejected, but they are
+ * only kept for the whole network namespace.  UDP_OVERFLOWS_UNKNOWN if
+ * neither can be read.
+ */
+uint64_t stats_udp_overflows(void)
+{
+	char header[512], line[512], *name, *value, *name_save, *value_save;
+	uint64_t overflows = 0;
+	int found = 0;
+	FILE *fp;
+
+	/* A line of names, then one of values, for each protocol */
+	fp = fopen("/proc/net/snmp", "r");
+	if (fp) {
+		found = 1;
+		while (fgets(header, sizeof(header), fp)) {
+			if (strncmp(header, "Udp: ", 5) || !fgets(line, sizeof(line), fp))
+				continue;
+
+			name = strtok_r(header, " \n", &name_save);
+			value = strtok_r(line, " \n", &value_save);
+			while (name && value) {
+				if (!strcmp(name, "RcvbufErrors"))
+					overflows += strtoull(value, NULL, 10);
+				name = strtok_r(NULL, " \n", &name_save);
+				value = strtok_r(NULL, " \n", &value_save);
+			}
+			break;
+		}
+		fclose(fp);
+	}
+
+	/* A name and its value on each line */
+	fp = fopen("/proc/net/snmp6", "r");
+	if (fp) {
+		found = 1;
+		while (fgets(line, sizeof(line), fp)) {
+			if (!strncmp(line, "Udp6RcvbufErrors", 16))
+				overflows += strtoull(&line[16], NULL, 10);
+		}
+		fclose(fp);
+	}
+
+	return found ? overflows : UDP_OVERFLOWS_UNKNOWN;
+}
+
+/*
+ * What the kernel dropped on the UDP socket of the worker, asked for at
+ * most once a second, from the worker loop rather than per packet.  The
+ * socket buffer overflows are kept in the worker for grow_udp_buffer(),
+ * the first thread also counts them since we started.  A now of 0 asks
+ * regardless, e.g. before exiting.
+ */
+void stats_socket(worker_t *worker, time_t now)
+{
+#ifdef SO_MEMINFO
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+#endif
+	uint64_t overflows;
+
+	if (now && now == stats_socket_time)
+		return;
+	stats_socket_time = now;
+
+#ifdef SO_MEMINFO
+	if (getsockopt(worker->udp_sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0 && len > SK_MEMINFO_DROPS * sizeof(uint32_t))
+		__atomic_store_n(&g_stats->kernel_dropped, meminfo[SK_MEMINFO_DROPS], __ATOMIC_RELAXED);
+#endif
+
+	overflows = stats_udp_overflows();
+	worker->udp_overflows = overflows;
+
+	/* Namespace wide, so only counted once */
+	if (g_stats_segment && g_stats == &g_stats_segment->thread_list[0] &&
+	    overflows != UDP_OVERFLOWS_UNKNOWN && stats_overflows_start != UDP_OVERFLOWS_UNKNOWN &&
+	    overflows >= stats_overflows_start)
+		__atomic_store_n(&g_stats->buffer_overflows, overflows - stats_overflows_start, __ATOMIC_RELAXED);
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
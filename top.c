@@ -0,0 +1,246 @@
+/* Live statistics viewer, built with 'make top'
+ *
+ * Maps the statistics segment of a running snmpbug read-only and shows
+ * its counters, summed over all worker threads, together with how fast
+ * they grew since the last refresh.  Nothing is asked of the daemon, the
+ * counters are read straight from the memory its threads write them to.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snmpbug.h"
+
+#define TOP_NR_COUNTERS		(sizeof(stats_t) / sizeof(uint64_t))
+
+static char            *m_prognm;
+static int              m_port = 161;
+static double           m_delay = 1;
+static long             m_count = -1;		/* Forever */
+static int              m_batch;
+
+static const stats_segment_t *m_segment;
+static size_t           m_segment_size;
+
+static int usage(int rc)
+{
+	printf("Usage: %s [options]\n"
+	       "\n"
+	       "  -b, --batch            Print plain text, do not clear the screen\n"
+	       "  -d, --delay SEC        Seconds between refreshes, default: 1\n"
+	       "  -h, --help             This help text\n"
+	       "  -n, --count NUM        Exit after NUM refreshes, default: never\n"
+	       "  -p, --port PORT        UDP port of the snmpbug to watch, default: 161\n"
+	       "\n", m_prognm);
+
+	return rc;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_segment(void)
+{
+	const stats_segment_t *segment;
+	char name[32];
+	struct stat st;
+	int fd;
+
+	snprintf(name, sizeof(name), STATS_NAME, m_port);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		fprintf(stderr, "could not open %s, is snmpbug running on port %d? %s\n",
+			name, m_port, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(stats_segment_t)) {
+		fprintf(stderr, "%s is not a statistics segment\n", name);
+		close(fd);
+		return -1;
+	}
+
+	segment = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED) {
+		fprintf(stderr, "could not map %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+	    segment->version != STATS_VERSION || segment->stats_size != sizeof(stats_t) ||
+	    sizeof(stats_segment_t) + segment->nr_threads * sizeof(stats_t) > (size_t)st.st_size) {
+		fprintf(stderr, "%s was written by another version of snmpbug\n", name);
+		munmap((void *)segment, st.st_size);
+		return -1;
+	}
+
+	m_segment = segment;
+	m_segment_size = st.st_size;
+
+	return 0;
+}
+
+/* Sum up the blocks of all threads, each counter read once */
+static void read_stats(stats_t *total)
+{
+	uint64_t *sum = (uint64_t *)total;
+	const uint64_t *counter;
+	size_t i, j;
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < m_segment->nr_threads; i++) {
+		counter = (const uint64_t *)&m_segment->thread_list[i];
+		for (j = 0; j < TOP_NR_COUNTERS; j++)
+			sum[j] += __atomic_load_n(&counter[j], __ATOMIC_RELAXED);
+	}
+}
+
+static void show(const char *name, uint64_t value, uint64_t last, double secs)
+{
+	printf("  %-20s %16llu %14.0f/s\n", name, (unsigned long long)value, (value - last) / secs);
+}
+
+static void display(const stats_t *s, const stats_t *l, double secs)
+{
+	static const char *decode[STATS_NR_DECODE] = { "header", "version", "community", "pdu", "varbinds" };
+	static const char *types[STATS_NR_TYPES] = { "get", "getnext", "getbulk", "set", "other" };
+	long uptime = time(NULL) - m_segment->started;
+	char name[32];
+	size_t i;
+
+	if (!m_batch)
+		printf("\033[H\033[2J");
+
+	printf("snmpbug pid %lld on port %d, %u threads, up %ldd %02ld:%02ld:%02ld%s\n\n",
+	       (long long)m_segment->pid, m_port, m_segment->nr_threads, uptime / 86400,
+	       uptime / 3600 % 24, uptime / 60 % 60, uptime % 60,
+	       kill(m_segment->pid, 0) == -1 && errno == ESRCH ? " (gone)" : "");
+
+	printf("  %-20s %16s %16s\n", "", "total", "rate");
+	show("packets in", s->packets_in, l->packets_in, secs);
+	show("packets out", s->packets_out, l->packets_out, secs);
+	show("bytes in", s->bytes_in, l->bytes_in, secs);
+	show("bytes out", s->bytes_out, l->bytes_out, secs);
+	show("rate limited", s->rate_limited, l->rate_limited, secs);
+	show("kernel dropped", s->kernel_dropped, l->kernel_dropped, secs);
+	show("buffer overflows", s->buffer_overflows, l->buffer_overflows, secs);
+	show("log lines dropped", s->log_dropped, l->log_dropped, secs);
+	printf("\n");
+
+	show("SNMPv1", s->versions[0], l->versions[0], secs);
+	show("SNMPv2c", s->versions[1], l->versions[1], secs);
+	for (i = 0; i < STATS_NR_TYPES; i++)
+		show(types[i], s->requests[i], l->requests[i], secs);
+	printf("\n");
+
+	for (i = 0; i < STATS_NR_DECODE; i++) {
+		snprintf(name, sizeof(name), "bad %s", decode[i]);
+		show(name, s->decode_errors[i], l->decode_errors[i], secs);
+	}
+	printf("\n");
+
+	show("TCP accepts", s->tcp_accepts, l->tcp_accepts, secs);
+	show("TCP evictions", s->tcp_evictions, l->tcp_evictions, secs);
+	printf("\n");
+
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	static const char short_options[] = "bd:hn:p:";
+	static const struct option long_options[] = {
+		{ "batch",        0, 0, 'b' },
+		{ "delay",        1, 0, 'd' },
+		{ "help",         0, 0, 'h' },
+		{ "count",        1, 0, 'n' },
+		{ "port",         1, 0, 'p' },
+		{ NULL, 0, 0, 0 }
+	};
+	stats_t stats, last;
+	double then, now;
+	int c;
+
+	m_prognm = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+
+	while ((c = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			m_batch = 1;
+			break;
+
+		case 'd':
+			m_delay = atof(optarg);
+			if (m_delay < 0.1) {
+				fprintf(stderr, "Invalid delay, must be at least 0.1 seconds\n");
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'h':
+			return usage(0);
+
+		case 'n':
+			m_count = atol(optarg);
+			if (m_count < 1) {
+				fprintf(stderr, "Invalid count, must be at least 1\n");
+				return usage(EXIT_ARGS);
+			}
+			break;
+
+		case 'p':
+			m_port = atoi(optarg);
+			break;
+
+		default:
+			return usage(EXIT_ARGS);
+		}
+	}
+
+	if (open_segment() == -1)
+		return EXIT_SYSCALL;
+
+	read_stats(&last);
+	then = now_sec();
+	while (m_count) {
+		usleep(m_delay * 1000000);
+		read_stats(&stats);
+		now = now_sec();
+		display(&stats, &last, now - then);
+		last = stats;
+		then = now;
+		if (m_count > 0)
+			m_count--;
+	}
+
+	munmap((void *)m_segment, m_segment_size);
+
+	return EXIT_OK;
+}
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -0,0 +1,597 @@
+/* io_uring event loop
+ *
+ * An alternative to the epoll loop in snmpbug.c, selected with --engine.
+ * UDP requests arrive through a multishot recvmsg into a ring of kernel
+ * provided buffers, TCP connections through a multishot accept, and all
+ * replies are queued as sends that go out with the next submission, so
+ * a busy worker makes one io_uring_enter() per batch of completions.
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#include "snmpbug.h"
+
+#ifdef IORING_RECV_MULTISHOT
+
+#define URING_NR_ENTRIES	256	/* Submission queue entries */
+#define URING_NR_BUFS		256	/* Provided UDP receive buffers, power of 2 */
+#define URING_BUF_GROUP		0
+#define URING_BUF_SIZE		(sizeof(struct io_uring_recvmsg_out) + sizeof(my_sockaddr_t) + UDP_CONTROL_SIZE + MAX_PACKET_SIZE)
+
+/* What a completion belongs to, kept in the low bits of user_data */
+#define URING_UDP_RECV		0
+#define URING_UDP_SEND		1
+#define URING_TCP_ACCEPT	2
+#define URING_TCP_CLIENT	3
+#define URING_KIND_MASK		3
+
+struct uring_s {
+	int                  fd;
+	unsigned            *sq_head;
+	unsigned            *sq_tail;
+	unsigned            *sq_array;
+	unsigned             sq_mask;
+	unsigned             sq_entries;
+	unsigned             sq_local_tail;
+	struct io_uring_sqe *sqe_list;
+	unsigned            *cq_head;
+	unsigned            *cq_tail;
+	unsigned             cq_mask;
+	struct io_uring_cqe *cqe_list;
+
+	/* Provided buffer ring the kernel picks UDP receive buffers from */
+	struct io_uring_buf_ring *buf_ring;
+	unsigned char       *buf_list;
+	unsigned short       buf_tail;
+	struct msghdr        recv_msg;
+	int                  recv_working;	/* A multishot receive delivered, so the kernel has it */
+
+	/* UDP replies in flight, built in the worker's udp_client_list */
+	struct msghdr        send_msg_list[MAX_UDP_BATCH];
+	struct iovec         send_iov_list[MAX_UDP_BATCH];
+	my_sockaddr_t        send_addr_list[MAX_UDP_BATCH];
+	char                 send_control_list[MAX_UDP_BATCH][UDP_CONTROL_SIZE];
+	unsigned short       send_free_list[MAX_UDP_BATCH];
+	size_t               send_free_length;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+			      unsigned flags, const void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Hand all queued submissions to the kernel, optionally waiting for completions */
+static int uring_submit(struct uring_s *ur, unsigned min_complete, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned to_submit, flags = 0;
+	int rv;
+
+	__atomic_store_n(ur->sq_tail, ur->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = ur->sq_local_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+
+	memset(&arg, 0, sizeof(arg));
+	if (min_complete) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		arg.ts = (uintptr_t)&ts;
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+	}
+
+	rv = sys_io_uring_enter(ur->fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+	if (rv == -1 && errno == ETIME)
+		return 0;
+
+	return rv;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring_s *ur)
+{
+	struct io_uring_sqe *sqe;
+	unsigned i;
+
+	/* Push out what is queued if the submission queue is full */
+	while (ur->sq_local_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) >= ur->sq_entries) {
+		if (uring_submit(ur, 0, 0) == -1 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+			logit(LOG_ERR, errno, "could not submit to io_uring");
+			exit(EXIT_SYSCALL);
+		}
+	}
+
+	i = ur->sq_local_tail & ur->sq_mask;
+	sqe = &ur->sqe_list[i];
+	memset(sqe, 0, sizeof(*sqe));
+	ur->sq_array[i] = i;
+	ur->sq_local_tail++;
+
+	return sqe;
+}
+
+static void uring_recycle_buf(struct uring_s *ur, unsigned short bid)
+{
+	struct io_uring_buf *buf = &ur->buf_ring->bufs[ur->buf_tail & (URING_NR_BUFS - 1)];
+
+	buf->addr = (uintptr_t)&ur->buf_list[bid * URING_BUF_SIZE];
+	buf->len = URING_BUF_SIZE;
+	buf->bid = bid;
+	ur->buf_tail++;
+}
+
+static void uring_arm_udp_recv(worker_t *worker)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(worker->uring);
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = worker->udp_sockfd;
+	sqe->addr = (uintptr_t)&worker->uring->recv_msg;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->user_data = URING_UDP_RECV;
+}
+
+static void uring_arm_tcp_accept(worker_t *worker)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(worker->uring);
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = worker->tcp_sockfd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = URING_TCP_ACCEPT;
+}
+
+/* Queue the next receive or send on a TCP client, there is always one pending */
+static void uring_arm_tcp_client(worker_t *worker, client_t *client)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(worker->uring);
+
+	if (client->outgoing) {
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (uintptr_t)client->packet;
+		sqe->len = client->size;
+	} else {
+		sqe->opcode = IORING_OP_RECV;
+		sqe->addr = (uintptr_t)(client->packet + client->size);
+		sqe->len = sizeof(client->packet) - client->size;
+	}
+	sqe->fd = client->sockfd;
+	sqe->user_data = (uintptr_t)client | URING_TCP_CLIENT;
+}
+
+static void uring_udp_received(worker_t *worker, const struct io_uring_cqe *cqe)
+{
+	struct uring_s *ur = worker->uring;
+	struct io_uring_recvmsg_out *out;
+	struct io_uring_sqe *sqe;
+	unsigned char *buf, *payload;
+	unsigned short bid, slot;
+	my_sockaddr_t *sockaddr;
+	struct msghdr control = { 0 };
+	struct timespec now;
+	client_t *client;
+	size_t len;
+
+	/* Before 5.19 multishot recvmsg fails at once, re-arming it would only spin */
+	if (cqe->res == -EINVAL && !ur->recv_working) {
+		logit(LOG_ERR, 0, "kernel too old for -E io_uring, no multishot recvmsg");
+		exit(EXIT_SYSCALL);
+	}
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		uring_arm_udp_recv(worker);
+
+	if (cqe->res < 0) {
+		if (cqe->res != -ENOBUFS)
+			logit(LOG_WARNING, -cqe->res, "Failed receiving UDP request");
+		return;
+	}
+	ur->recv_working = 1;
+
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	buf = &ur->buf_list[bid * URING_BUF_SIZE];
+	out = (struct io_uring_recvmsg_out *)buf;
+	payload = buf + sizeof(*out) + ur->recv_msg.msg_namelen + ur->recv_msg.msg_controllen;
+	len = (size_t)cqe->res - (payload - buf);
+	if ((size_t)cqe->res < (size_t)(payload - buf) || out->namelen > sizeof(my_sockaddr_t)) {
+		uring_recycle_buf(ur, bid);
+		return;
+	}
+
+	STATS_INC(packets_in);
+	STATS_ADD(bytes_in, len);
+
+	/* Over its budget, the source is not worth decoding let alone answering */
+	if (g_rate_limit) {
+		sockaddr = (my_sockaddr_t *)(buf + sizeof(*out));
+		if (ratelimit(&sockaddr->my_sin_addr, ratelimit_clock()) == -1) {
+			STATS_INC(rate_limited);
+			uring_recycle_buf(ur, bid);
+			return;
+		}
+	}
+
+	/* Too many replies still in flight, shed the request */
+	if (!ur->send_free_length) {
+		logit(LOG_DEBUG, 0, "UDP reply queue full, dropping request");
+		uring_recycle_buf(ur, bid);
+		return;
+	}
+	slot = ur->send_free_list[--ur->send_free_length];
+
+	sockaddr = &ur->send_addr_list[slot];
+	memcpy(sockaddr, buf + sizeof(*out), out->namelen);
+	client = &worker->udp_client_list[slot];
+	control.msg_control = buf + sizeof(*out) + ur->recv_msg.msg_namelen;
+	control.msg_controllen = out->controllen;
+	handle_udp_control(worker, client, &control);
+	LATENCY_REALTIME(now);
+	LATENCY_ARRIVAL(LATENCY_QUEUE, client, now);
+	client->sockfd = worker->udp_sockfd;
+	client->addr = sockaddr->my_sin_addr;
+	client->port = sockaddr->my_sin_port;
+	client->size = len;
+	memcpy(client->packet, payload, len);
+	uring_recycle_buf(ur, bid);
+
+	if (handle_udp_request(client) == -1) {
+		ur->send_free_list[ur->send_free_length++] = slot;
+		return;
+	}
+
+	ur->send_iov_list[slot].iov_base = client->packet;
+	ur->send_iov_list[slot].iov_len = client->size;
+	ur->send_msg_list[slot].msg_name = sockaddr;
+	ur->send_msg_list[slot].msg_namelen = out->namelen;
+	ur->send_msg_list[slot].msg_iov = &ur->send_iov_list[slot];
+	ur->send_msg_list[slot].msg_iovlen = 1;
+	handle_udp_source(client, &ur->send_msg_list[slot], ur->send_control_list[slot]);
+
+	sqe = uring_get_sqe(ur);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = worker->udp_sockfd;
+	sqe->addr = (uintptr_t)&ur->send_msg_list[slot];
+	sqe->msg_flags = MSG_DONTWAIT;
+	sqe->user_data = ((uint64_t)slot << 2) | URING_UDP_SEND;
+}
+
+static void uring_udp_sent(worker_t *worker, const struct io_uring_cqe *cqe)
+{
+	const char *snd_msg = "Failed UDP response to";
+	struct uring_s *ur = worker->uring;
+	unsigned short slot = cqe->user_data >> 2;
+	client_t *client = &worker->udp_client_list[slot];
+	char straddr[my_inet_addrstrlen] = { 0 };
+	struct timespec now;
+
+	if (cqe->res > 0) {
+		STATS_INC(packets_out);
+		STATS_ADD(bytes_out, cqe->res);
+		LATENCY_REALTIME(now);
+		LATENCY_ARRIVAL(LATENCY_RESPONSE, client, now);
+	}
+	if (cqe->res < 0 || (size_t)cqe->res != client->size) {
+		inet_ntop(my_af_inet, &client->addr, straddr, sizeof(straddr));
+		if (cqe->res == -EAGAIN || cqe->res == -ENOBUFS)
+			grow_udp_buffer(worker, SO_SNDBUF);
+		if (cqe->res < 0)
+			logit(LOG_WARNING, -cqe->res, "%s %s:%d", snd_msg, straddr, client->port);
+		else
+			logit(LOG_WARNING, 0, "%s %s:%d: only %d of %zu bytes sent", snd_msg, straddr,
+			      client->port, cqe->res, client->size);
+	}
+
+	ur->send_free_list[ur->send_free_length++] = slot;
+}
+
+static void uring_tcp_accepted(worker_t *worker, const struct io_uring_cqe *cqe)
+{
+	const char *msg = "Could not accept TCP connection";
+	my_sockaddr_t sockaddr;
+	my_socklen_t socklen;
+	client_t *client;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		uring_arm_tcp_accept(worker);
+
+	if (cqe->res < 0) {
+		logit(LOG_ERR, -cqe->res, "%s", msg);
+		return;
+	}
+
+	memset(&sockaddr, 0, sizeof(sockaddr));
+	socklen = sizeof(sockaddr);
+	if (getpeername(cqe->res, (struct sockaddr *)&sockaddr, &socklen) == -1) {
+		logit(LOG_DEBUG, errno, "%s", msg);
+		close(cqe->res);
+		return;
+	}
+
+	/*
+	 * Make room for the new client by kicking out the oldest one.  Its
+	 * pending receive or send still refers to it, so only shut down the
+	 * connection here and let that completion close and free it.
+	 */
+	if (worker->tcp_client_list_length >= g_max_clients) {
+		client = evict_tcp_client(worker);
+		if (!client) {
+			logit(LOG_ERR, 0, "%s: internal error", msg);
+			exit(EXIT_SYSCALL);
+		}
+
+		shutdown(client->sockfd, SHUT_RDWR);
+	}
+
+	client = add_tcp_client(worker, cqe->res, &sockaddr);
+	if (!client)
+		exit(EXIT_SYSCALL);
+
+	uring_arm_tcp_client(worker, client);
+}
+
+static void uring_tcp_client(worker_t *worker, const struct io_uring_cqe *cqe)
+{
+	client_t *client = (client_t *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_KIND_MASK);
+	ssize_t rv = cqe->res;
+
+	/* Evicted while the operation was pending */
+	if (client->index == (size_t)-1) {
+		close(client->sockfd);
+		free(client);
+		return;
+	}
+
+	if (rv < 0) {
+		errno = -rv;
+		rv = -1;
+	}
+
+	if (client->outgoing)
+		handle_tcp_client_sent(client, rv);
+	else
+		handle_tcp_client_received(client, rv);
+
+	/* If there was a TCP disconnect, remove the client from the list */
+	if (client->sockfd == -1) {
+		remove_tcp_client(worker, client);
+		free(client);
+		return;
+	}
+
+	uring_arm_tcp_client(worker, client);
+}
+
+int uring_open(worker_t *worker)
+{
+	struct io_uring_params params;
+	struct io_uring_buf_reg reg;
+	struct uring_s *ur;
+	unsigned char *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, i;
+
+	ur = allocate(sizeof(*ur));
+	if (!ur)
+		return -1;
+	memset(ur, 0, sizeof(*ur));
+
+	/* Multishot receives post many completions per submission, size the CQ for it */
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = 4 * URING_NR_ENTRIES;
+	ur->fd = sys_io_uring_setup(URING_NR_ENTRIES, &params);
+	if (ur->fd == -1 && errno == EINVAL) {
+		params.flags &= ~IORING_SETUP_COOP_TASKRUN;
+		ur->fd = sys_io_uring_setup(URING_NR_ENTRIES, &params);
+	}
+	if (ur->fd == -1) {
+		logit(LOG_ERR, errno, "could not set up io_uring");
+		free(ur);
+		return -1;
+	}
+
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		logit(LOG_ERR, 0, "io_uring lacks timeout support, kernel too old");
+		errno = ENOSYS;
+		goto fail;
+	}
+
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ur->fd, IORING_OFF_SQ_RING);
+	cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ur->fd, IORING_OFF_CQ_RING);
+	ur->sqe_list = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || ur->sqe_list == MAP_FAILED) {
+		logit(LOG_ERR, errno, "could not map io_uring");
+		goto fail;
+	}
+
+	ur->sq_head = (unsigned *)(sq_ring + params.sq_off.head);
+	ur->sq_tail = (unsigned *)(sq_ring + params.sq_off.tail);
+	ur->sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+	ur->sq_mask = *(unsigned *)(sq_ring + params.sq_off.ring_mask);
+	ur->sq_entries = params.sq_entries;
+	ur->sq_local_tail = *ur->sq_tail;
+	ur->cq_head = (unsigned *)(cq_ring + params.cq_off.head);
+	ur->cq_tail = (unsigned *)(cq_ring + params.cq_off.tail);
+	ur->cq_mask = *(unsigned *)(cq_ring + params.cq_off.ring_mask);
+	ur->cqe_list = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+
+	/* Register the UDP receive buffers with the kernel */
+	ur->buf_ring = mmap(NULL, URING_NR_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ur->buf_list = mmap(NULL, URING_NR_BUFS * URING_BUF_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ur->buf_ring == MAP_FAILED || ur->buf_list == MAP_FAILED) {
+		logit(LOG_ERR, errno, "could not allocate io_uring buffers");
+		goto fail;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)ur->buf_ring;
+	reg.ring_entries = URING_NR_BUFS;
+	reg.bgid = URING_BUF_GROUP;
+	if (sys_io_uring_register(ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		logit(LOG_ERR, errno, "could not register io_uring buffer ring");
+		goto fail;
+	}
+
+	for (i = 0; i < URING_NR_BUFS; i++)
+		uring_recycle_buf(ur, i);
+	__atomic_store_n(&ur->buf_ring->tail, ur->buf_tail, __ATOMIC_RELEASE);
+
+	/* Only the sizes matter, the kernel lays out name, control and payload in each buffer */
+	ur->recv_msg.msg_namelen = sizeof(my_sockaddr_t);
+	ur->recv_msg.msg_controllen = UDP_CONTROL_SIZE;
+
+	for (i = 0; i < MAX_UDP_BATCH; i++)
+		ur->send_free_list[ur->send_free_length++] = i;
+
+	worker->uring = ur;
+
+	return 0;
+
+fail:
+	close(ur->fd);
+	free(ur);
+
+	return -1;
+}
+
+/* Submit and look for completions without sleeping for up to g_busy_poll us, 1 when there are some */
+static int uring_spin(struct uring_s *ur)
+{
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		if (uring_submit(ur, 0, 0) == -1)
+			return -1;
+		if (*ur->cq_head != __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE))
+			return 1;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while (!g_quit && (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000 < g_busy_poll);
+
+	return 0;
+}
+
+void *run_uring_worker(void *arg)
+{
+	worker_t *worker = arg;
+	struct uring_s *ur = worker->uring;
+	const struct io_uring_cqe *cqe;
+	unsigned head, tail;
+
+	pin_thread(worker->id);
+	stats_thread(worker->id);
+	latency_thread(worker->id);
+	uring_arm_udp_recv(worker);
+	uring_arm_tcp_accept(worker);
+
+	/* Handle incoming connect requests and incoming data */
+	while (!g_quit) {
+		latency_poll();
+
+		/* Submit the replies queued so far and sleep until there is more to do */
+		if ((!g_busy_poll || uring_spin(ur) != 1) && uring_submit(ur, 1, g_timeout * 10) == -1) {
+			if (g_quit)
+				break;
+			if (errno == EINTR || errno == EBUSY || errno == EAGAIN)
+				continue;
+
+			logit(LOG_ERR, errno, "could not wait for io_uring completions");
+			exit(EXIT_SYSCALL);
+		}
+
+		head = *ur->cq_head;
+		tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &ur->cqe_list[head & ur->cq_mask];
+
+			switch (cqe->user_data & URING_KIND_MASK) {
+			case URING_UDP_RECV:
+				uring_udp_received(worker, cqe);
+				break;
+
+			case URING_UDP_SEND:
+				uring_udp_sent(worker, cqe);
+				break;
+
+			case URING_TCP_ACCEPT:
+				uring_tcp_accepted(worker, cqe);
+				break;
+
+			case URING_TCP_CLIENT:
+				uring_tcp_client(worker, cqe);
+				break;
+			}
+		}
+		__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+		/* Give the consumed receive buffers back to the kernel */
+		__atomic_store_n(&ur->buf_ring->tail, ur->buf_tail, __ATOMIC_RELEASE);
+
+		aggregate_flush(time(NULL), 0);
+		stats_socket(worker, time(NULL));
+	}
+
+	aggregate_flush(time(NULL), 1);
+	stats_socket(worker, 0);
+
+	return NULL;
+}
+
+#else /* !IORING_RECV_MULTISHOT */
+
+int uring_open(worker_t *UNUSED(worker))
+{
+	logit(LOG_ERR, 0, "io_uring engine not supported by this build");
+	errno = ENOSYS;
+
+	return -1;
+}
+
+void *run_uring_worker(void *arg)
+{
+	return arg;
+}
+
+#endif /* IORING_RECV_MULTISHOT */
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -17,11 +17,31 @@
 #include <stdio.h>
 #include <limits.h>
 #include <string.h>
-#include <stdarg.h>
 #include <sys/time.h>
  
 #include "snmpbug.h"
 
+/* Hex encode data as "XX XX ..", truncated to what fits in buf */
+size_t hexdump(char *buf, size_t size, const unsigned char *data, size_t len)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	size_t i, pos = 0;
+
+	if (!size)
+		return 0;
+
+	for (i = 0; i < len && pos + 3 <= size; i++) {
+		buf[pos++] = digits[data[i] >> 4];
+		buf[pos++] = digits[data[i] & 0x0F];
+		buf[pos++] = ' ';
+	}
+	if (pos)
+		pos--;		/* The last separator becomes the terminator */
+	buf[pos] = '\0';
+
+	return pos;
+}
+
 void *allocate(size_t len)
 {
 	char *buf = malloc(len);
@@ -77,56 +97,22 @@ int split(const char *str, char *delim, char **list, int max_list_length)
 	return len;
 }
 
-client_t *find_oldest_client(void)
+client_t *find_oldest_client(const worker_t *worker)
 {
 	size_t i, found = 0, pos = 0;
 	time_t timestamp = (time_t)LONG_MAX;
 
-	for (i = 0; i < g_tcp_client_list_length; i++) {
-		if (timestamp > g_tcp_client_list[i]->timestamp) {
-			timestamp = g_tcp_client_list[i]->timestamp;
+	for (i = 0; i < worker->tcp_client_list_length; i++) {
+		if (timestamp > worker->tcp_client_list[i]->timestamp ||
+		    (found && timestamp == worker->tcp_client_list[i]->timestamp &&
+		     worker->tcp_client_list[pos]->serial > worker->tcp_client_list[i]->serial)) {
+			timestamp = worker->tcp_client_list[i]->timestamp;
 			found = 1;
 			pos = i;
 		}
 	}
 
-	return found ? g_tcp_client_list[pos] : NULL;
-}
-
-int logit(int priority, int syserr, const char *fmt, ...)
-{
-	va_list ap;
-	char *buf;
-	int len, i;
-
-	if (LOG_PRI(priority) > g_level)
-		return 0;
-
-	va_start(ap, fmt);
-	len = vsnprintf(NULL, 0, fmt, ap);
-	va_end(ap);
-	if (len < 0)
-		return -1;
-
-	/* length of ": error-message" */
-	len += 3 + (syserr > 0 ? strlen(strerror(syserr)) : 0);
-	buf = alloca(len);
-	if (!buf)
-		return -1;
-
-	va_start(ap, fmt);
-	i = vsnprintf(buf, len, fmt, ap);
-	va_end(ap);
-	if (i < 0)
-		return -1;
-
-	if (syserr > 0)
-		i += snprintf(&buf[i], len - i, ": %s", strerror(syserr));
-
-	i = fprintf(stdout, "%s\n", buf);
-	fflush(stdout);
-
-	return i;
+	return found ? worker->tcp_client_list[pos] : NULL;
 }
 
 /* vim: ts=4 sts=4 sw=4 nowrap